@@ -0,0 +1,14 @@
+#!/bin/sh
+# Builds the plain, ThinLTO and PGO release variants and runs workload.sh on each.
+# Extra arguments are passed to cmake.
+set -e
+for variant in none thinlto; do
+	cmake -S . -B "_build_$variant" -DSNOW_VARIANT=$variant "$@" > /dev/null
+	cmake --build "_build_$variant" -j"$(nproc)" > /dev/null
+done
+BUILD=_build_pgo ./pgo.sh "$@" > /dev/null
+
+for build in _build_none _build_thinlto _build_pgo; do
+	echo "== $build"
+	./workload.sh "$build"
+done
@@ -1 +1,7 @@
-clang++ -O3 -march=native -Wall `sdl2-config --cflags` `sdl2-config --libs` -lSDL2_image -framework OpenGL src/main.cpp -o snow
+#!/bin/sh
+# Builds everything with CMake into _build (or $BUILD), on Linux and macOS alike.
+# Extra arguments are passed to cmake, see README.md.
+set -e
+BUILD=${BUILD:-_build}
+cmake -S . -B "$BUILD" "$@"
+cmake --build "$BUILD" -j"$(getconf _NPROCESSORS_ONLN)"
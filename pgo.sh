@@ -0,0 +1,24 @@
+#!/bin/sh
+# Two step profile guided build: an instrumented build is trained on
+# workload.sh, then everything is rebuilt with the collected profile.
+# Extra arguments are passed to cmake. Usage: ./pgo.sh [-DGLM_INCLUDE_DIR=...]
+set -e
+BUILD=${BUILD:-_build_pgo}
+PGO_DIR=$(pwd)/$BUILD/pgo
+
+rm -rf "$PGO_DIR"
+cmake -S . -B "$BUILD" -DSNOW_VARIANT=pgo-generate -DSNOW_PGO_DIR="$PGO_DIR" "$@"
+cmake --build "$BUILD" --clean-first -j"$(nproc)"
+# A profile missing the render workload would quietly leave the viewer untrained
+if ! ./workload.sh "$BUILD" > /dev/null; then
+	echo "pgo.sh: the training workload failed or couldn't run the viewer, not building with an incomplete profile" >&2
+	exit 1
+fi
+
+# clang writes raw profiles that have to be merged, gcc's are used as they are
+if ls "$PGO_DIR"/*.profraw > /dev/null 2>&1; then
+	llvm-profdata merge -output="$PGO_DIR/default.profdata" "$PGO_DIR"/*.profraw
+fi
+
+cmake -S . -B "$BUILD" -DSNOW_VARIANT=pgo-use -DSNOW_PGO_DIR="$PGO_DIR" "$@"
+cmake --build "$BUILD" --clean-first -j"$(nproc)"
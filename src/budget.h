@@ -0,0 +1,469 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <algorithm>
+
+#include "common.h"
+#include "chunk.h"
+#include "world_file.h"
+
+// Caps on what the loaded world keeps in memory, in three tiers: block data
+// (packed or not), CPU copies of meshes and the GPU vertex buffer. Over a cap,
+// the sections that score worst, far from the camera and long unneeded, give
+// memory back in order of how cheap it is to get back:
+//   1. meshes whose vertices are in the vertex buffer, which is drawn from anyway
+//   2. any other mesh, it's built again from the blocks when it's needed
+//   3. block data, run length encoded in memory once the section's mesh is gone
+//   4. packed block data that generation makes again, dropped
+// Sections with evicted blocks are frozen: block ticks leave them alone until a
+// change reaches them or one of their ticks is due, which brings the blocks back.
+// Sections with ticks scheduled give memory back after all the others, and the
+// ones the last block tick changed pack their blocks last and only lose their
+// meshes when nothing else is left, farthest first. Those are counted apart, a
+// world changing faster than its caps hold shows up there. The GPU tier picks which
+// sections get room in the vertex buffer at all, the farthest past its cap aren't drawn.
+
+// A section unneeded for this many frames scores as if it was one section farther away
+#define BUDGET_AGE_FRAMES 60
+
+// How much nearer than the farthest drawn section one left out of the vertex
+// buffer has to be before the buffer is laid out again, in sections
+#define BUDGET_GPU_HYSTERESIS 1.0f
+
+enum {
+	TIER_BLOCKS,
+	TIER_MESHES,
+	TIER_GPU,
+	BUDGET_TIERS,
+};
+
+const char *budget_tier_names[BUDGET_TIERS] = { "blocks", "meshes", "gpu" };
+
+typedef struct BudgetTier {
+	// Bytes, 0 for no cap
+	u64 cap;
+	u64 used;
+
+	// Sections that gave memory back in this tier, and how much, since the start
+	u64 evictions;
+	u64 evicted_bytes;
+} BudgetTier;
+
+typedef struct BudgetCandidate {
+	u32 index;
+	f32 score;
+} BudgetCandidate;
+
+typedef struct MemoryBudget {
+	BudgetTier tiers[BUDGET_TIERS];
+
+	// Part of the block tier that's packed
+	u64 packed_bytes;
+
+	// Sections left out of the vertex buffer by the last budget_place(), and
+	// the distance of the farthest one that was placed, in sections
+	u32 gpu_left_out;
+	f32 gpu_reach;
+
+	// Evictions of sections the last block tick changed, since the start
+	u64 kept_evictions;
+
+	BudgetCandidate *candidates;
+	// Sections budget_enforce() evicts last this frame
+	bool *keep;
+	u32 count;
+} MemoryBudget;
+
+// Budgets a world of count sections, caps in bytes with 0 for none
+void budget_init(MemoryBudget *budget, u32 count, u64 block_cap, u64 mesh_cap, u64 gpu_cap) {
+	bzero(budget, sizeof(MemoryBudget));
+	budget->tiers[TIER_BLOCKS].cap = block_cap;
+	budget->tiers[TIER_MESHES].cap = mesh_cap;
+	budget->tiers[TIER_GPU].cap = gpu_cap;
+	budget->candidates = (BudgetCandidate *)malloc(count * sizeof(BudgetCandidate));
+	budget->keep = (bool *)calloc(count, sizeof(bool));
+	budget->count = count;
+}
+
+void budget_free(MemoryBudget *budget) {
+	free(budget->candidates);
+	free(budget->keep);
+}
+
+bool budget_over(MemoryBudget *budget, u32 tier) {
+	return budget->tiers[tier].cap > 0 && budget->tiers[tier].used > budget->tiers[tier].cap;
+}
+
+template <typename C>
+u32 chunk_unpacked_bytes() {
+	return sizeof(typename C::Slice) * (C::width + 2);
+}
+
+// Block data the section holds in memory, packed or not
+template <typename C>
+u64 chunk_blocks_size(C *chunk) {
+	return chunk->blocks != NULL ? chunk_unpacked_bytes<C>() : chunk->packed_size;
+}
+
+template <typename C>
+u64 chunk_mesh_bytes(C *chunk) {
+	return chunk->mesh != NULL ? chunk->mesh_size * sizeof(Vertex) : 0;
+}
+
+template <typename C>
+bool chunk_mesh_dropped(C *chunk) {
+	return chunk->mesh == NULL && chunk->mesh_size > 0;
+}
+
+// Distance from the camera in sections, plus one for every BUDGET_AGE_FRAMES unneeded
+template <typename C>
+f32 budget_score(C *chunk, glm::vec3 cam_pos, bool aged) {
+	glm::vec3 centre = glm::vec3(chunk->x_off, chunk->y_off, chunk->z_off) + glm::vec3(C::width + 2, C::height + 2, C::depth + 2) * 0.5f;
+	f32 score = glm::length(centre - cam_pos) / C::width;
+	if (aged) {
+		score += (f32)(budget_frame - chunk->last_used) / BUDGET_AGE_FRAMES;
+	}
+	return score;
+}
+
+template <typename C>
+void chunk_drop_mesh(C *chunk) {
+	counter_add(&metrics.frees, 1);
+	counter_add(&metrics.meshes_dropped, 1);
+	gauge_add(&metrics.mesh_bytes, -(i64)(chunk->mesh_size * sizeof(Vertex)));
+
+	free(chunk->mesh);
+	chunk->mesh = NULL;
+}
+
+// Replaces the block array with its run length encoding, returns the bytes freed
+template <typename C>
+u64 chunk_pack_blocks(C *chunk) {
+	u32 block_bytes = chunk_unpacked_bytes<C>();
+
+	// Runs are at most 255 long, so the encoding can't be more than twice the size
+	thread_local u8 *scratch = NULL;
+	if (scratch == NULL) {
+		scratch = (u8 *)malloc(block_bytes * 2);
+	}
+
+	u32 packed_size = rle_encode((u8 *)chunk->blocks, block_bytes, scratch);
+	chunk->packed = (u8 *)malloc(packed_size);
+	chunk->packed_size = packed_size;
+	memcpy(chunk->packed, scratch, packed_size);
+
+	free(chunk->blocks);
+	chunk->blocks = NULL;
+	chunk->evicted = BLOCKS_PACKED;
+
+	counter_add(&metrics.blocks_packed, 1);
+	gauge_add(&metrics.chunks_with_blocks, -1);
+	gauge_add(&metrics.block_bytes, -(i64)block_bytes);
+	gauge_add(&metrics.packed_block_bytes, packed_size);
+
+	return block_bytes - packed_size;
+}
+
+// Drops packed blocks of a pristine section, returns the bytes freed
+template <typename C>
+u64 chunk_discard_blocks(C *chunk) {
+	u64 freed = chunk->packed_size;
+
+	counter_add(&metrics.frees, 1);
+	counter_add(&metrics.blocks_discarded, 1);
+	gauge_add(&metrics.packed_block_bytes, -(i64)chunk->packed_size);
+
+	free(chunk->packed);
+	chunk->packed = NULL;
+	chunk->packed_size = 0;
+	chunk->evicted = BLOCKS_DISCARDED;
+
+	return freed;
+}
+
+// Brings evicted block data back, unpacking it or generating the section again.
+// Safe from the block tick passes, which own the chunk's whole neighbourhood.
+template <typename C>
+void chunk_restore_blocks(C *chunk) {
+	if (chunk->evicted == BLOCKS_RESIDENT) {
+		return;
+	}
+
+	u64 start = metrics_now_ns();
+	if (chunk->evicted == BLOCKS_PACKED) {
+		chunk_alloc_blocks(chunk);
+		rle_decode(chunk->packed, chunk->packed_size, (u8 *)chunk->blocks, chunk_unpacked_bytes<C>());
+
+		counter_add(&metrics.frees, 1);
+		gauge_add(&metrics.packed_block_bytes, -(i64)chunk->packed_size);
+		free(chunk->packed);
+		chunk->packed = NULL;
+		chunk->packed_size = 0;
+	} else {
+		// Taking over the fresh section's blocks keeps the memory metrics straight
+		C *fresh = generate_chunk<C>(floor_div(chunk->x_off, C::width), floor_div(chunk->y_off, C::height), floor_div(chunk->z_off, C::depth));
+		chunk->blocks = fresh->blocks;
+		fresh->blocks = NULL;
+		free_chunk(fresh);
+	}
+
+	chunk->evicted = BLOCKS_RESIDENT;
+	chunk->last_used = budget_frame;
+
+	counter_add(&metrics.blocks_restored, 1);
+	histogram_observe(&metrics.restore_time, metrics_now_ns() - start);
+}
+
+// Brings back whatever the budget evicted, so the section's blocks and mesh can be changed
+template <typename C>
+void chunk_restore(C *chunk) {
+	chunk_restore_blocks(chunk);
+	if (chunk_mesh_dropped(chunk)) {
+		generate_mesh(chunk, NULL);
+	}
+}
+
+// The section's blocks for reading without bringing them back: evicted ones are
+// unpacked or generated into a per thread copy, valid until the next call.
+// column, which may be NULL, saves generating the section's column again.
+// NULL when the section is uniform, as with chunk->blocks.
+template <typename C>
+typename C::Slice *chunk_peek_blocks(C *chunk, ChunkColumn<C> *column) {
+	if (chunk->evicted == BLOCKS_RESIDENT) {
+		return chunk->blocks;
+	}
+
+	thread_local typename C::Slice *scratch = NULL;
+	if (scratch == NULL) {
+		scratch = (typename C::Slice *)malloc(chunk_unpacked_bytes<C>());
+	}
+
+	// Discarded sections are always exactly what generation makes, so the last
+	// one generated stays good for as long as the copy isn't reused, e.g. for
+	// every border block a tick syncs into the same frozen neighbour
+	thread_local bool generated = false;
+	thread_local i64 generated_off[3];
+	thread_local u32 generated_seed;
+
+	if (chunk->evicted == BLOCKS_PACKED) {
+		rle_decode(chunk->packed, chunk->packed_size, (u8 *)scratch, chunk_unpacked_bytes<C>());
+		generated = false;
+	} else if (generated && generated_off[0] == chunk->x_off && generated_off[1] == chunk->y_off && generated_off[2] == chunk->z_off
+		&& generated_seed == world_seed) {
+		return scratch;
+	} else {
+		i64 c_y = floor_div(chunk->y_off, C::height);
+		C *fresh = column ? generate_chunk<C>(column, c_y) : generate_chunk<C>(floor_div(chunk->x_off, C::width), c_y, floor_div(chunk->z_off, C::depth));
+		memcpy(scratch, fresh->blocks, chunk_unpacked_bytes<C>());
+		free_chunk(fresh);
+
+		generated = true;
+		generated_off[0] = chunk->x_off;
+		generated_off[1] = chunk->y_off;
+		generated_off[2] = chunk->z_off;
+		generated_seed = world_seed;
+	}
+	return scratch;
+}
+
+// One block of the section without bringing its blocks back. Packed sections
+// are read by walking the runs up to the block instead of unpacking them.
+template <typename C>
+u8 chunk_peek_block(C *chunk, u32 x, u32 y, u32 z) {
+	if (chunk->evicted == BLOCKS_RESIDENT) {
+		return chunk_block(chunk, x, y, z);
+	}
+
+	if (chunk->evicted == BLOCKS_PACKED) {
+		u32 offset = (x * (C::height + 2) + y) * (C::depth + 2) + z;
+		for (u32 i = 0; i + 1 < chunk->packed_size; i += 2) {
+			if (offset < chunk->packed[i]) {
+				return chunk->packed[i + 1];
+			}
+			offset -= chunk->packed[i];
+		}
+		return 0;
+	}
+	return chunk_peek_blocks(chunk, (ChunkColumn<C> *)NULL)[x][y][z];
+}
+
+// Picks the sections that get room in the vertex buffer, nearest first until
+// the GPU cap. chunks[i] needs capacity[i] vertices; placed[i] is set for those
+// that fit and evictions are counted against on_gpu[i], where the last layout
+// placed them. Returns the vertices placed.
+template <typename C>
+u64 budget_place(MemoryBudget *budget, C **chunks, u32 *capacity, bool *on_gpu, bool *placed, glm::vec3 cam_pos) {
+	BudgetCandidate *candidates = budget->candidates;
+	for (u32 i = 0; i < budget->count; i++) {
+		candidates[i].index = i;
+		candidates[i].score = budget_score(chunks[i], cam_pos, false);
+	}
+	std::sort(candidates, candidates + budget->count, [](const BudgetCandidate &a, const BudgetCandidate &b) {
+		return a.score < b.score;
+	});
+
+	BudgetTier *tier = &budget->tiers[TIER_GPU];
+	u64 vertices = 0;
+	bool full = false;
+	budget->gpu_left_out = 0;
+	budget->gpu_reach = 0.0f;
+	for (u32 c = 0; c < budget->count; c++) {
+		u32 i = candidates[c].index;
+		full = full || (tier->cap > 0 && (vertices + capacity[i]) * sizeof(Vertex) > tier->cap);
+
+		// Nothing to draw takes no room, so it's never left out
+		placed[i] = !full || capacity[i] == 0;
+		if (!placed[i]) {
+			budget->gpu_left_out++;
+			if (on_gpu[i]) {
+				tier->evictions++;
+				tier->evicted_bytes += chunks[i]->mesh_size * sizeof(Vertex);
+				counter_add(&metrics.gpu_evictions, 1);
+			}
+			continue;
+		}
+
+		vertices += capacity[i];
+		if (capacity[i] > 0) {
+			budget->gpu_reach = candidates[c].score;
+		}
+	}
+
+	tier->used = vertices * sizeof(Vertex);
+	return vertices;
+}
+
+// Brings the world's block data and meshes under their caps, see the top of the
+// file. on_gpu[i] is set when chunks[i] has its vertices in the vertex buffer,
+// the num_changed sections in changed were just remeshed by block ticks.
+// Call once a frame. Returns true when a section left out of the vertex buffer
+// came near enough for the buffer to be laid out again with budget_place().
+template <typename C>
+bool budget_enforce(MemoryBudget *budget, C **chunks, bool *on_gpu, u32 *changed, u32 num_changed, glm::vec3 cam_pos) {
+	budget_frame++;
+
+	BudgetTier *blocks = &budget->tiers[TIER_BLOCKS];
+	BudgetTier *meshes = &budget->tiers[TIER_MESHES];
+	blocks->used = 0;
+	meshes->used = 0;
+	budget->packed_bytes = 0;
+
+	f32 nearest_left_out = FLT_MAX;
+	for (u32 i = 0; i < budget->count; i++) {
+		C *chunk = chunks[i];
+		blocks->used += chunk_blocks_size(chunk);
+		meshes->used += chunk_mesh_bytes(chunk);
+		budget->packed_bytes += chunk->packed_size;
+
+		if (budget->gpu_left_out > 0 && !on_gpu[i] && chunk->mesh_size > 0) {
+			nearest_left_out = std::min(nearest_left_out, budget_score(chunk, cam_pos, false));
+		}
+	}
+
+	if (budget_over(budget, TIER_BLOCKS) || budget_over(budget, TIER_MESHES)) {
+		BudgetCandidate *candidates = budget->candidates;
+		for (u32 i = 0; i < budget->count; i++) {
+			candidates[i].index = i;
+			candidates[i].score = budget_score(chunks[i], cam_pos, true);
+		}
+		// Sections with ticks scheduled last, a due tick brings their blocks straight back
+		std::sort(candidates, candidates + budget->count, [=](const BudgetCandidate &a, const BudgetCandidate &b) {
+			bool a_ticks = chunks[a.index]->num_ticks > 0;
+			bool b_ticks = chunks[b.index]->num_ticks > 0;
+			if (a_ticks != b_ticks) {
+				return b_ticks;
+			}
+			return a.score > b.score;
+		});
+
+		// A section that was just remeshed is likely to change again on the next tick
+		for (u32 i = 0; i < num_changed; i++) {
+			budget->keep[changed[i]] = true;
+		}
+
+		// Meshes the vertex buffer still holds first, then the rest
+		for (u32 pass = 0; pass < 2; pass++) {
+			for (u32 c = 0; c < budget->count && budget_over(budget, TIER_MESHES); c++) {
+				C *chunk = chunks[candidates[c].index];
+				if (chunk->mesh == NULL || budget->keep[candidates[c].index] || (pass == 0 && !on_gpu[candidates[c].index])) {
+					continue;
+				}
+
+				meshes->used -= chunk_mesh_bytes(chunk);
+				meshes->evictions++;
+				meshes->evicted_bytes += chunk_mesh_bytes(chunk);
+				chunk_drop_mesh(chunk);
+			}
+		}
+
+		// Block data packs once its mesh is gone, and is only dropped when packing
+		// wasn't enough. Sections just remeshed pack last and keep their mesh,
+		// which is still what their blocks look like.
+		for (u32 pass = 0; pass < 2; pass++) {
+			for (u32 c = 0; c < budget->count && budget_over(budget, TIER_BLOCKS); c++) {
+				C *chunk = chunks[candidates[c].index];
+				bool keep = budget->keep[candidates[c].index];
+				if (chunk->blocks == NULL || keep != (pass == 1)) {
+					continue;
+				}
+
+				if (chunk->mesh != NULL && !keep) {
+					meshes->used -= chunk_mesh_bytes(chunk);
+					meshes->evictions++;
+					meshes->evicted_bytes += chunk_mesh_bytes(chunk);
+					chunk_drop_mesh(chunk);
+				}
+
+				u64 freed = chunk_pack_blocks(chunk);
+				blocks->used -= freed;
+				blocks->evictions++;
+				blocks->evicted_bytes += freed;
+				budget->packed_bytes += chunk->packed_size;
+				if (keep) {
+					budget->kept_evictions++;
+					counter_add(&metrics.kept_evictions, 1);
+				}
+			}
+		}
+		for (u32 c = 0; c < budget->count && budget_over(budget, TIER_BLOCKS); c++) {
+			C *chunk = chunks[candidates[c].index];
+			if (chunk->evicted != BLOCKS_PACKED || !chunk->pristine) {
+				continue;
+			}
+
+			u64 freed = chunk_discard_blocks(chunk);
+			blocks->used -= freed;
+			blocks->evictions++;
+			blocks->evicted_bytes += freed;
+			budget->packed_bytes -= freed;
+		}
+
+		// Still over with only just remeshed meshes left, they go too, farthest first
+		if (budget_over(budget, TIER_MESHES)) {
+			std::sort(candidates, candidates + budget->count, [](const BudgetCandidate &a, const BudgetCandidate &b) {
+				return a.score > b.score;
+			});
+			for (u32 c = 0; c < budget->count && budget_over(budget, TIER_MESHES); c++) {
+				C *chunk = chunks[candidates[c].index];
+				if (chunk->mesh == NULL || !budget->keep[candidates[c].index]) {
+					continue;
+				}
+
+				meshes->used -= chunk_mesh_bytes(chunk);
+				meshes->evictions++;
+				meshes->evicted_bytes += chunk_mesh_bytes(chunk);
+				chunk_drop_mesh(chunk);
+				budget->kept_evictions++;
+				counter_add(&metrics.kept_evictions, 1);
+			}
+		}
+
+		for (u32 i = 0; i < num_changed; i++) {
+			budget->keep[changed[i]] = false;
+		}
+	}
+
+	return nearest_left_out < budget->gpu_reach - BUDGET_GPU_HYSTERESIS;
+}
+
+#endif
@@ -0,0 +1,369 @@
+#include <thread>
+#include <algorithm>
+
+#define STB_PERLIN_IMPLEMENTATION
+#include "chunk.h"
+#include "budget.h"
+#include "ticks.h"
+
+// A region much wider than the viewer's, flown over headlessly under memory caps
+// a fraction of what it needs uncapped. Each frame the budget evicts what's over
+// its caps and, as the viewer's upload does, sections the flight comes near get
+// back into the vertex buffer, built again if their mesh was dropped. The first
+// flight only evicts and brings back, so every section must end up exactly as
+// generated. The second runs block ticks with snow falling into frozen sections,
+// after which every border copy must still match the block it mirrors.
+
+#define BENCH_CHUNKS_X 24
+#define BENCH_CHUNKS_Y 6
+#define BENCH_CHUNKS_Z 24
+#define BENCH_MIN_C_Y -1
+#define BENCH_FRAMES 600
+#define BENCH_CAP_PERCENT 25
+
+// How often the flight reads the whole region's blocks, as the viewer does for the
+// ground the snow lands on each time its window moves
+#define BENCH_SURFACE_FRAMES 60
+
+#define BENCH_COUNT (BENCH_CHUNKS_X * BENCH_CHUNKS_Y * BENCH_CHUNKS_Z)
+
+typedef struct BenchWorld {
+	Chunk *chunks[BENCH_COUNT];
+	ChunkColumn<Chunk> columns[BENCH_CHUNKS_X * BENCH_CHUNKS_Z];
+	bool on_gpu[BENCH_COUNT];
+	bool placed[BENCH_COUNT];
+	u32 capacity[BENCH_COUNT];
+} BenchWorld;
+
+u64 fnv(u64 hash, const void *data, u32 size) {
+	for (u32 i = 0; i < size; i++) {
+		hash = (hash ^ ((u8 *)data)[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+// Every block, border included, and every vertex field of the section
+u64 section_hash(Chunk *chunk) {
+	u64 hash = 14695981039346656037ull;
+	for (u32 x = 0; x <= Chunk::width + 1; x++) {
+		for (u32 y = 0; y <= Chunk::height + 1; y++) {
+			for (u32 z = 0; z <= Chunk::depth + 1; z++) {
+				u8 block = chunk_block(chunk, x, y, z);
+				hash = fnv(hash, &block, 1);
+			}
+		}
+	}
+	for (u32 i = 0; i < chunk->mesh_size; i++) {
+		Vertex *v = &chunk->mesh[i];
+		hash = fnv(hash, &v->point, sizeof(v->point));
+		hash = fnv(hash, &v->t_point, 3);
+	}
+	return fnv(hash, chunk->bucket_start, sizeof(chunk->bucket_start));
+}
+
+void bench_generate(BenchWorld *world) {
+	for (u32 x = 0; x < BENCH_CHUNKS_X; x++) {
+		for (u32 z = 0; z < BENCH_CHUNKS_Z; z++) {
+			ChunkColumn<Chunk> *column = &world->columns[COMPRESS_TWO(x, z, BENCH_CHUNKS_X)];
+			generate_column(column, x, z);
+			for (u32 y = 0; y < BENCH_CHUNKS_Y; y++) {
+				Chunk *chunk = generate_chunk(column, (i64)BENCH_MIN_C_Y + y);
+				generate_mesh(chunk, NULL);
+				world->chunks[COMPRESS_THREE(x, y, z, BENCH_CHUNKS_X, BENCH_CHUNKS_Y)] = chunk;
+			}
+		}
+	}
+
+	for (u32 i = 0; i < BENCH_COUNT; i++) {
+		world->on_gpu[i] = true;
+		world->capacity[i] = world->chunks[i]->mesh_size;
+	}
+}
+
+void bench_free(BenchWorld *world) {
+	for (u32 i = 0; i < BENCH_COUNT; i++) {
+		free_chunk(world->chunks[i]);
+	}
+}
+
+// What the region takes uncapped, per tier
+void bench_usage(BenchWorld *world, u64 *used) {
+	bzero(used, sizeof(u64) * BUDGET_TIERS);
+	for (u32 i = 0; i < BENCH_COUNT; i++) {
+		used[TIER_BLOCKS] += chunk_blocks_size(world->chunks[i]);
+		used[TIER_MESHES] += chunk_mesh_bytes(world->chunks[i]);
+		used[TIER_GPU] += world->chunks[i]->mesh_size * sizeof(Vertex);
+	}
+}
+
+glm::vec3 bench_camera(u32 frame) {
+	f32 t = frame * 2.0f * 3.14159265f / BENCH_FRAMES;
+	f32 centre_x = BENCH_CHUNKS_X * Chunk::width / 2.0f;
+	f32 centre_z = BENCH_CHUNKS_Z * Chunk::depth / 2.0f;
+	return glm::vec3(centre_x + cosf(t) * centre_x * 0.6f, 80.0f, centre_z + sinf(t) * centre_z * 0.6f);
+}
+
+// Lays the vertex buffer out again as upload_world() does, building the meshes
+// of sections that come back into it. Returns the meshes built.
+u32 bench_place(BenchWorld *world, MemoryBudget *budget, glm::vec3 cam_pos) {
+	budget_place(budget, world->chunks, world->capacity, world->on_gpu, world->placed, cam_pos);
+
+	u32 rebuilt = 0;
+	for (u32 i = 0; i < BENCH_COUNT; i++) {
+		if (world->placed[i] && !world->on_gpu[i] && chunk_mesh_dropped(world->chunks[i])) {
+			chunk_restore(world->chunks[i]);
+			rebuilt++;
+		}
+		world->on_gpu[i] = world->placed[i];
+	}
+	return rebuilt;
+}
+
+// Scans every column from the top down as build_surface() does, returns a checksum so it isn't optimised out
+u64 bench_surface(BenchWorld *world) {
+	u64 sum = 0;
+	for (u32 x = 0; x < BENCH_CHUNKS_X; x++) {
+		for (u32 z = 0; z < BENCH_CHUNKS_Z; z++) {
+			for (i32 y = BENCH_CHUNKS_Y - 1; y >= 0; y--) {
+				Chunk *chunk = world->chunks[COMPRESS_THREE(x, y, z, BENCH_CHUNKS_X, BENCH_CHUNKS_Y)];
+				Chunk::Slice *blocks = chunk_peek_blocks(chunk, &world->columns[COMPRESS_TWO(x, z, BENCH_CHUNKS_X)]);
+				if (blocks == NULL) {
+					if (chunk->fill) {
+						break;
+					}
+					continue;
+				}
+				sum += blocks[Chunk::width / 2][Chunk::height / 2][Chunk::depth / 2];
+			}
+		}
+	}
+	return sum;
+}
+
+// Hangs snow in the sky sections, high enough to fall into the ones below. Returns the blocks dropped.
+u32 bench_drop_snow(BenchWorld *world) {
+	u32 dropped = 0;
+	for (u32 i = 0; i < BENCH_COUNT; i++) {
+		Chunk *chunk = world->chunks[i];
+		if (chunk->blocks != NULL || chunk->fill || chunk->y_off < TERRAIN_AVG_HEIGHT) {
+			continue;
+		}
+
+		chunk_materialize(chunk);
+		for (u32 x = 1; x <= Chunk::width; x += 11) {
+			for (u32 z = 1; z <= Chunk::depth; z += 11) {
+				chunk->blocks[x][Chunk::height / 2][z] = BLOCK_SNOW;
+				chunk_schedule(chunk, x, Chunk::height / 2, z, 1);
+				dropped++;
+			}
+		}
+	}
+	return dropped;
+}
+
+// Every border block that mirrors one inside the region has to match it. Returns the mismatches.
+u32 bench_check_borders(BenchWorld *world) {
+	u32 mismatches = 0;
+	u32 dims[3] = { Chunk::width, Chunk::height, Chunk::depth };
+	u32 grid[3] = { BENCH_CHUNKS_X, BENCH_CHUNKS_Y, BENCH_CHUNKS_Z };
+
+	for (u32 i = 0; i < BENCH_COUNT; i++) {
+		Chunk *chunk = world->chunks[i];
+		i32 g[3] = { (i32)(i % BENCH_CHUNKS_X), (i32)((i / BENCH_CHUNKS_X) % BENCH_CHUNKS_Y), (i32)(i / (BENCH_CHUNKS_X * BENCH_CHUNKS_Y)) };
+
+		for (u32 x = 0; x <= Chunk::width + 1; x++) {
+			for (u32 y = 0; y <= Chunk::height + 1; y++) {
+				for (u32 z = 0; z <= Chunk::depth + 1; z++) {
+					u32 pos[3] = { x, y, z };
+					i32 owner[3];
+					u32 local[3];
+					bool border = false;
+					bool inside = true;
+					for (u32 a = 0; a < 3; a++) {
+						owner[a] = g[a];
+						local[a] = pos[a];
+						if (pos[a] == 0) {
+							owner[a]--;
+							local[a] = dims[a];
+							border = true;
+						} else if (pos[a] == dims[a] + 1) {
+							owner[a]++;
+							local[a] = 1;
+							border = true;
+						}
+						inside = inside && owner[a] >= 0 && owner[a] < (i32)grid[a];
+					}
+					if (!border || !inside) {
+						continue;
+					}
+
+					Chunk *other = world->chunks[COMPRESS_THREE(owner[0], owner[1], owner[2], BENCH_CHUNKS_X, BENCH_CHUNKS_Y)];
+					if (chunk_block(chunk, x, y, z) != chunk_block(other, local[0], local[1], local[2])) {
+						mismatches++;
+					}
+				}
+			}
+		}
+	}
+	return mismatches;
+}
+
+void print_tiers(const char *label, u64 *values) {
+	printf("  %s: blocks %.2f MiB, meshes %.2f MiB, gpu %.2f MiB\n", label, values[TIER_BLOCKS] / (1024.0 * 1024.0),
+		values[TIER_MESHES] / (1024.0 * 1024.0), values[TIER_GPU] / (1024.0 * 1024.0));
+}
+
+// Flies once around the region under the caps. Returns the frames that ended
+// with a tier still over its cap, which only sections just changed by ticks can cause.
+u32 bench_flight(BenchWorld *world, u64 *caps, BlockTicker<Chunk> *ticker) {
+	MemoryBudget budget;
+	budget_init(&budget, BENCH_COUNT, caps[TIER_BLOCKS], caps[TIER_MESHES], caps[TIER_GPU]);
+
+	u64 restored = metrics.blocks_restored.value;
+	u64 restore_ns = metrics.restore_time.sum;
+	u64 generated = metrics.chunks_generated.value;
+
+	u64 peak[BUDGET_TIERS] = {};
+	u64 budget_ns = 0;
+	u64 place_ns = 0;
+	u64 surface_ns = 0;
+	u64 tick_ns = 0;
+	u32 layouts = 0;
+	u32 rebuilt = 0;
+	u32 over = 0;
+	u32 most_changed = 0;
+	u64 checksum = 0;
+
+	bench_place(world, &budget, bench_camera(0));
+	for (u32 frame = 0; frame < BENCH_FRAMES; frame++) {
+		glm::vec3 cam_pos = bench_camera(frame);
+
+		if (ticker != NULL) {
+			u64 start = metrics_now_ns();
+			block_ticker_update(ticker, 1.0f / TICK_HZ);
+			block_ticker_remesh(ticker);
+			tick_ns += metrics_now_ns() - start;
+			most_changed = std::max(most_changed, ticker->num_remesh);
+		}
+
+		u64 start = metrics_now_ns();
+		bool stale = budget_enforce(&budget, world->chunks, world->on_gpu, ticker ? ticker->remesh : NULL, ticker ? ticker->num_remesh : 0, cam_pos);
+		budget_ns += metrics_now_ns() - start;
+
+		if (stale) {
+			start = metrics_now_ns();
+			rebuilt += bench_place(world, &budget, cam_pos);
+			place_ns += metrics_now_ns() - start;
+			layouts++;
+		}
+
+		if (frame % BENCH_SURFACE_FRAMES == 0) {
+			start = metrics_now_ns();
+			checksum += bench_surface(world);
+			surface_ns += metrics_now_ns() - start;
+		}
+
+		// Whatever brought blocks or meshes back this frame is evicted again on the next one
+		for (u32 t = 0; t < BUDGET_TIERS; t++) {
+			peak[t] = std::max(peak[t], budget.tiers[t].used);
+		}
+		over += budget_over(&budget, TIER_BLOCKS) || budget_over(&budget, TIER_MESHES) || budget_over(&budget, TIER_GPU);
+	}
+
+	u64 used[BUDGET_TIERS];
+	for (u32 t = 0; t < BUDGET_TIERS; t++) {
+		used[t] = budget.tiers[t].used;
+	}
+	print_tiers("end of flight", used);
+	print_tiers("peak after eviction", peak);
+	printf("  packed: %.2f MiB, %u sections left out of the vertex buffer\n", budget.packed_bytes / (1024.0 * 1024.0), budget.gpu_left_out);
+
+	for (u32 t = 0; t < BUDGET_TIERS; t++) {
+		printf("  %s: %llu evictions (%.1f/s at 60 fps), %.2f MiB freed\n", budget_tier_names[t], (unsigned long long)budget.tiers[t].evictions,
+			budget.tiers[t].evictions * 60.0 / BENCH_FRAMES, budget.tiers[t].evicted_bytes / (1024.0 * 1024.0));
+	}
+
+	restored = metrics.blocks_restored.value - restored;
+	restore_ns = metrics.restore_time.sum - restore_ns;
+	generated = metrics.chunks_generated.value - generated;
+	printf("  %llu block restores (%.1f us each), %llu sections generated again, %u meshes built again\n", (unsigned long long)restored,
+		restored ? restore_ns / 1000.0 / restored : 0.0, (unsigned long long)generated, rebuilt);
+	printf("  per frame: %.3f ms budget, %.3f ms relayout (%u layouts)%s", budget_ns / 1e6 / BENCH_FRAMES, place_ns / 1e6 / BENCH_FRAMES, layouts,
+		ticker ? "" : "\n");
+	if (ticker != NULL) {
+		printf(", %.3f ms ticks\n", tick_ns / 1e6 / BENCH_FRAMES);
+		printf("  at most %u sections changed by a tick, %.2f MiB of blocks; %llu evictions of sections the last tick changed\n", most_changed,
+			most_changed * chunk_unpacked_bytes<Chunk>() / (1024.0 * 1024.0), (unsigned long long)budget.kept_evictions);
+	}
+	printf("  surface scan: %.3f ms (checksum %llu)\n", surface_ns / 1e6 / (BENCH_FRAMES / BENCH_SURFACE_FRAMES), (unsigned long long)checksum);
+
+	budget_free(&budget);
+	return over;
+}
+
+int main() {
+	metrics_init();
+
+	BenchWorld *world = (BenchWorld *)malloc(sizeof(BenchWorld));
+	bench_generate(world);
+
+	u64 uncapped[BUDGET_TIERS];
+	bench_usage(world, uncapped);
+	u64 caps[BUDGET_TIERS];
+	for (u32 t = 0; t < BUDGET_TIERS; t++) {
+		caps[t] = uncapped[t] * BENCH_CAP_PERCENT / 100;
+	}
+
+	printf("%u sections, %u frames around the region, caps at %u%%\n", BENCH_COUNT, BENCH_FRAMES, BENCH_CAP_PERCENT);
+	print_tiers("uncapped", uncapped);
+	print_tiers("caps", caps);
+
+	u64 *hashes = (u64 *)malloc(sizeof(u64) * BENCH_COUNT);
+	for (u32 i = 0; i < BENCH_COUNT; i++) {
+		hashes[i] = section_hash(world->chunks[i]);
+	}
+
+	printf("evicting and restoring\n");
+	u32 over = bench_flight(world, caps, NULL);
+	if (over > 0) {
+		printf("  %u frames ended over a cap!\n", over);
+	}
+	bool ok = over == 0;
+
+	u32 changed = 0;
+	for (u32 i = 0; i < BENCH_COUNT; i++) {
+		chunk_restore(world->chunks[i]);
+		changed += section_hash(world->chunks[i]) != hashes[i];
+	}
+	printf("  %u/%u sections as generated after restoring\n", BENCH_COUNT - changed, BENCH_COUNT);
+	ok = ok && changed == 0;
+	free(hashes);
+
+	JobPool pool;
+	job_pool_start(&pool, std::max(std::thread::hardware_concurrency(), 1u) - 1);
+
+	BlockTicker<Chunk> ticker;
+	block_ticker_init(&ticker, world->chunks, BENCH_CHUNKS_X, BENCH_CHUNKS_Y, BENCH_CHUNKS_Z, &pool);
+
+	u32 dropped = bench_drop_snow(world);
+	printf("with block ticks, %u snow blocks dropped\n", dropped);
+	over = bench_flight(world, caps, &ticker);
+	if (over > 0) {
+		printf("  %u frames ended over a cap!\n", over);
+	}
+	ok = ok && over == 0;
+
+	for (u32 i = 0; i < BENCH_COUNT; i++) {
+		chunk_restore(world->chunks[i]);
+	}
+	u32 mismatches = bench_check_borders(world);
+	printf("  %u border blocks differ from the block they mirror\n", mismatches);
+	ok = ok && mismatches == 0;
+
+	block_ticker_free(&ticker);
+	job_pool_stop(&pool);
+	bench_free(world);
+	free(world);
+
+	return ok ? 0 : 1;
+}
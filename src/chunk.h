@@ -0,0 +1,705 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include <float.h>
+#include <string.h>
+#include <glm/glm.hpp>
+
+#include "stb_perlin.h"
+
+#include "common.h"
+#include "metrics.h"
+
+// Override with -DCHUNK_WIDTH=16 -DCHUNK_HEIGHT=128 -DCHUNK_DEPTH=16 for the old column layout
+#ifndef CHUNK_WIDTH
+#define CHUNK_WIDTH 32
+#endif
+#ifndef CHUNK_HEIGHT
+#define CHUNK_HEIGHT 32
+#endif
+#ifndef CHUNK_DEPTH
+#define CHUNK_DEPTH 32
+#endif
+
+#define TERRAIN_MIN_HEIGHT 21
+#define TERRAIN_AVG_HEIGHT 42
+
+// Seed 0 is the original terrain
+u32 world_seed = 0;
+
+// Frames counted by the memory budget, sections remember the last one they were needed in, see budget.h
+u64 budget_frame = 0;
+
+glm::vec3 cube_edges[] = {
+	glm::vec3(-0.0f, -0.0f,  1.0f),
+	glm::vec3( 1.0f, -0.0f,  1.0f),
+	glm::vec3(-0.0f,  1.0f,  1.0f),
+	glm::vec3( 1.0f,  1.0f,  1.0f),
+	glm::vec3(-0.0f, -0.0f, -0.0f),
+	glm::vec3( 1.0f, -0.0f, -0.0f),
+	glm::vec3(-0.0f,  1.0f, -0.0f),
+	glm::vec3( 1.0f,  1.0f, -0.0f),
+};
+
+// Block ids double as the block's texture in the atlas
+enum {
+	BLOCK_AIR,
+	BLOCK_GRASS,
+	BLOCK_DIRT,
+	BLOCK_SNOW,
+	BLOCK_WATER,
+};
+
+// A block update due on a later tick, at block index x, y, z of the chunk
+typedef struct ScheduledTick {
+	u64 due;
+	u16 x;
+	u16 y;
+	u16 z;
+} ScheduledTick;
+
+typedef struct Vertex {
+	glm::vec3 point;
+	u8 t_point;
+	u8 tex_id;
+	u8 ao;
+} Vertex;
+
+// Meshes are grouped by face direction so the renderer can skip every face of a
+// chunk that points away from the camera. Sides sit between top and bottom as
+// they are the ones most often drawn together.
+enum {
+	FACE_TOP,
+	FACE_LEFT,
+	FACE_RIGHT,
+	FACE_FRONT,
+	FACE_BACK,
+	FACE_BOTTOM,
+	FACE_DIRECTIONS,
+};
+
+// Where a section's block data is, the memory budget evicts it under pressure
+enum {
+	BLOCKS_RESIDENT,
+	BLOCKS_PACKED,
+	BLOCKS_DISCARDED,
+};
+
+// Dimensions are compile-time so the block array is sized exactly and the
+// meshing loops unroll per variant, e.g. BasicChunk<16, 128, 16> columns or
+// BasicChunk<32, 32, 32> cubic sections stacked vertically without limit.
+// Block indices 1..W/H/D are the chunk itself, 0 and W+1 etc. mirror the
+// neighbouring chunks so faces and AO can be decided without looking them up.
+template <u32 W, u32 H, u32 D>
+struct BasicChunk {
+	static const u32 width = W;
+	static const u32 height = H;
+	static const u32 depth = D;
+
+	typedef u8 Slice[H + 2][D + 2];
+
+	// NULL when the whole section, border included, is sky (fill == 0) or
+	// underground (fill != 0). Such sections can't have faces and cost no block memory.
+	Slice *blocks;
+	u8 fill;
+
+	Vertex *mesh;
+	u32 mesh_size;
+
+	// Faces of direction d are mesh[bucket_start[d]..bucket_start[d + 1])
+	u32 bucket_start[FACE_DIRECTIONS + 1];
+
+	// Pending block updates, see ticks.h
+	ScheduledTick *ticks;
+	u32 num_ticks;
+	u32 ticks_capacity;
+
+	// Unless resident, blocks is NULL and the block data is run length encoded in
+	// packed or was dropped to be generated again, see budget.h. A NULL mesh with
+	// a mesh_size was dropped too, mesh_size and bucket_start still describe it.
+	u8 evicted;
+	u8 *packed;
+	u32 packed_size;
+
+	// Blocks are still exactly what generation makes, so they can be dropped and made again
+	bool pristine;
+
+	// Last budget_frame the section's blocks or mesh were needed
+	u64 last_used;
+
+	// World position of block index 0
+	i64 x_off;
+	i64 y_off;
+	i64 z_off;
+};
+
+typedef BasicChunk<CHUNK_WIDTH, CHUNK_HEIGHT, CHUNK_DEPTH> Chunk;
+
+typedef struct MeshBucket {
+	Vertex *verts;
+	u32 size;
+	u32 capacity;
+} MeshBucket;
+
+// Each thread meshes into its own buckets, which are then packed into the chunk
+thread_local MeshBucket mesh_scratch[FACE_DIRECTIONS];
+
+typedef struct MeshStats {
+	u64 blocks;
+	u64 faces;
+} MeshStats;
+
+Vertex new_vert(glm::vec3 edge, glm::vec3 offset, u8 tex_id, u8 t_point, u8 ao) {
+	Vertex v;
+	v.point = edge + offset;
+	v.t_point = t_point;
+	v.tex_id = tex_id;
+	v.ao = ao;
+	return v;
+}
+
+enum {
+	SIDE_FRONT    = 0b0000000001,
+	SIDE_BACK     = 0b0000000010,
+	SIDE_TOP      = 0b0000000100,
+	SIDE_BOTTOM   = 0b0000001000,
+	SIDE_LEFT     = 0b0000010000,
+	SIDE_RIGHT    = 0b0000100000,
+	SIDE_TL_DIAG  = 0b0001000000,
+	SIDE_TR_DIAG  = 0b0010000000,
+	SIDE_BL_DIAG  = 0b0100000000,
+	SIDE_BR_DIAG  = 0b1000000000,
+};
+
+i64 floor_div(i64 a, i64 b) {
+	i64 q = a / b;
+	if ((a % b != 0) && ((a < 0) != (b < 0))) {
+		q -= 1;
+	}
+	return q;
+}
+
+f32 terrain_height(i64 x, i64 z) {
+	// The seed picks a different slice and offset of the same noise field
+	f32 seed_x = (f32)((world_seed * 2654435761u) >> 16);
+	f32 seed_z = (f32)((world_seed * 2246822519u) >> 16);
+	f32 seed_w = (f32)(world_seed % 61) * 4.0f;
+
+	f32 column_height = TERRAIN_AVG_HEIGHT;
+	for (u8 o = 5; o < 8; o++) {
+		f32 scale = (f32)(2 << o) * 1.01f;
+		column_height += (f32)(o << 3) * stb_perlin_noise3(((f32)x + seed_x) / scale, ((f32)z + seed_z) / scale, o * 2.0f + seed_w, 256, 256, 256);
+	}
+
+	if (column_height < TERRAIN_MIN_HEIGHT) {
+		column_height = TERRAIN_MIN_HEIGHT;
+	}
+
+	return column_height;
+}
+
+u8 block_for_height(i64 y) {
+	i64 layer = ((y % 6) + 6) % 6;
+	if ((layer % 2) == 0) {
+		return BLOCK_GRASS;
+	} else if ((layer % 3) == 0) {
+		return BLOCK_DIRT;
+	}
+	return BLOCK_SNOW;
+}
+
+template <typename C>
+u8 chunk_block(C *chunk, u32 x, u32 y, u32 z) {
+	if (chunk->blocks != NULL) {
+		return chunk->blocks[x][y][z];
+	}
+	return chunk->fill ? block_for_height(chunk->y_off + y) : 0;
+}
+
+template <typename C>
+u16 get_air_neighbors(C *chunk, u32 x, u32 y, u32 z) {
+	u16 neighbors = 0;
+
+	// y may sit on the border layer so faces on a section's top and bottom get
+	// the AO of the section above or below; its out of range neighbours count as solid
+	if (x == 0 || z == 0 || x > C::width || y > C::height + 1 || z > C::depth) {
+		return neighbors;
+	}
+
+	if (chunk->blocks[x - 1][y][z] == 0) {
+		neighbors |= SIDE_LEFT;
+	}
+	if (chunk->blocks[x + 1][y][z] == 0) {
+		neighbors |= SIDE_RIGHT;
+	}
+	if (y <= C::height && chunk->blocks[x][y + 1][z] == 0) {
+		neighbors |= SIDE_TOP;
+	}
+	if (y > 0 && chunk->blocks[x][y - 1][z] == 0) {
+		neighbors |= SIDE_BOTTOM;
+	}
+	if (chunk->blocks[x][y][z + 1] == 0) {
+		neighbors |= SIDE_FRONT;
+	}
+	if (chunk->blocks[x][y][z - 1] == 0) {
+		neighbors |= SIDE_BACK;
+	}
+
+	if (chunk->blocks[x - 1][y][z - 1] == 0) {
+		neighbors |= SIDE_BL_DIAG;
+	}
+	if (chunk->blocks[x + 1][y][z - 1] == 0) {
+		neighbors |= SIDE_BR_DIAG;
+	}
+	if (chunk->blocks[x - 1][y][z + 1] == 0) {
+		neighbors |= SIDE_TL_DIAG;
+	}
+	if (chunk->blocks[x + 1][y][z + 1] == 0) {
+		neighbors |= SIDE_TR_DIAG;
+	}
+
+	return neighbors;
+}
+
+template <typename C>
+void add_face(C *chunk, u16 side, u32 x, u32 y, u32 z, u16 neighbors, Vertex *out) {
+	glm::vec3 offset = glm::vec3(x + chunk->x_off, y + chunk->y_off, z + chunk->z_off);
+	u8 tex_id = chunk->blocks[x][y][z];
+
+	u16 g_ao = ~neighbors;
+	u8 ao = 255;
+	u8 tl = ao;
+	u8 tr = ao;
+	u8 bl = ao;
+	u8 br = ao;
+	u8 dark_val = 50;
+
+	switch (side) {
+		case SIDE_TOP: {
+			if (g_ao & SIDE_FRONT) {
+				tl -= dark_val;
+				tr -= dark_val;
+			}
+			if (g_ao & SIDE_BACK) {
+				bl -= dark_val;
+				br -= dark_val;
+			}
+			if (g_ao & SIDE_LEFT) {
+				bl -= dark_val;
+				tl -= dark_val;
+			}
+			if (g_ao & SIDE_RIGHT) {
+				br -= dark_val;
+				tr -= dark_val;
+			}
+
+			if (g_ao & SIDE_TR_DIAG) {
+				tr -= dark_val;
+			}
+			if (g_ao & SIDE_TL_DIAG) {
+				tl -= dark_val;
+			}
+			if (g_ao & SIDE_BL_DIAG) {
+				bl -= dark_val;
+			}
+			if (g_ao & SIDE_BR_DIAG) {
+				br -= dark_val;
+			}
+
+			if (tr + bl > br + tl) {
+				out[0] = new_vert(cube_edges[2], offset, tex_id, 0, tl);
+				out[1] = new_vert(cube_edges[3], offset, tex_id, 1, tr);
+				out[2] = new_vert(cube_edges[6], offset, tex_id, 2, bl);
+				out[3] = new_vert(cube_edges[3], offset, tex_id, 1, tr);
+				out[4] = new_vert(cube_edges[7], offset, tex_id, 3, br);
+				out[5] = new_vert(cube_edges[6], offset, tex_id, 2, bl);
+			} else {
+				out[0] = new_vert(cube_edges[2], offset, tex_id, 0, tl);
+				out[1] = new_vert(cube_edges[3], offset, tex_id, 1, tr);
+				out[2] = new_vert(cube_edges[7], offset, tex_id, 3, br);
+				out[3] = new_vert(cube_edges[2], offset, tex_id, 0, tl);
+				out[4] = new_vert(cube_edges[7], offset, tex_id, 3, br);
+				out[5] = new_vert(cube_edges[6], offset, tex_id, 2, bl);
+			}
+
+		} break;
+		case SIDE_BOTTOM: {
+			if (g_ao & SIDE_BACK) {
+				tl -= dark_val;
+				tr -= dark_val;
+			}
+			if (g_ao & SIDE_FRONT) {
+				bl -= dark_val;
+				br -= dark_val;
+			}
+			if (g_ao & SIDE_LEFT) {
+				bl -= dark_val;
+				tl -= dark_val;
+			}
+			if (g_ao & SIDE_RIGHT) {
+				br -= dark_val;
+				tr -= dark_val;
+			}
+
+			out[0] = new_vert(cube_edges[4], offset, tex_id, 0, tl);
+			out[1] = new_vert(cube_edges[5], offset, tex_id, 1, tr);
+			out[2] = new_vert(cube_edges[1], offset, tex_id, 3, br);
+			out[3] = new_vert(cube_edges[4], offset, tex_id, 0, tl);
+			out[4] = new_vert(cube_edges[1], offset, tex_id, 3, br);
+			out[5] = new_vert(cube_edges[0], offset, tex_id, 2, bl);
+		} break;
+		case SIDE_LEFT: {
+			if (g_ao & SIDE_BOTTOM) {
+				tl -= dark_val;
+				tr -= dark_val;
+			}
+			if (g_ao & SIDE_TOP) {
+				bl -= dark_val;
+				br -= dark_val;
+			}
+			if (g_ao & SIDE_BACK) {
+				bl -= dark_val;
+				tl -= dark_val;
+			}
+			if (g_ao & SIDE_FRONT) {
+				br -= dark_val;
+				tr -= dark_val;
+			}
+
+			out[0] = new_vert(cube_edges[4], offset, tex_id, 0, tl);
+			out[1] = new_vert(cube_edges[0], offset, tex_id, 1, tr);
+			out[2] = new_vert(cube_edges[2], offset, tex_id, 3, br);
+			out[3] = new_vert(cube_edges[4], offset, tex_id, 0, tl);
+			out[4] = new_vert(cube_edges[2], offset, tex_id, 3, br);
+			out[5] = new_vert(cube_edges[6], offset, tex_id, 2, bl);
+		} break;
+		case SIDE_RIGHT: {
+			if (g_ao & SIDE_BOTTOM) {
+				tl -= dark_val;
+				tr -= dark_val;
+			}
+			if (g_ao & SIDE_TOP) {
+				bl -= dark_val;
+				br -= dark_val;
+			}
+			if (g_ao & SIDE_FRONT) {
+				bl -= dark_val;
+				tl -= dark_val;
+			}
+			if (g_ao & SIDE_BACK) {
+				br -= dark_val;
+				tr -= dark_val;
+			}
+			out[0] = new_vert(cube_edges[1], offset, tex_id, 0, tl);
+			out[1] = new_vert(cube_edges[5], offset, tex_id, 1, tr);
+			out[2] = new_vert(cube_edges[7], offset, tex_id, 3, br);
+			out[3] = new_vert(cube_edges[1], offset, tex_id, 0, tl);
+			out[4] = new_vert(cube_edges[7], offset, tex_id, 3, br);
+			out[5] = new_vert(cube_edges[3], offset, tex_id, 2, bl);
+		} break;
+		case SIDE_FRONT: {
+			if (g_ao & SIDE_BOTTOM) {
+				tl -= dark_val;
+				tr -= dark_val;
+			}
+			if (g_ao & SIDE_TOP) {
+				bl -= dark_val;
+				br -= dark_val;
+			}
+			if (g_ao & SIDE_LEFT) {
+				bl -= dark_val;
+				tl -= dark_val;
+			}
+			if (g_ao & SIDE_RIGHT) {
+				br -= dark_val;
+				tr -= dark_val;
+			}
+			out[0] = new_vert(cube_edges[0], offset, tex_id, 0, tl);
+			out[1] = new_vert(cube_edges[1], offset, tex_id, 1, tr);
+			out[2] = new_vert(cube_edges[3], offset, tex_id, 3, br);
+			out[3] = new_vert(cube_edges[0], offset, tex_id, 0, tl);
+			out[4] = new_vert(cube_edges[3], offset, tex_id, 3, br);
+			out[5] = new_vert(cube_edges[2], offset, tex_id, 2, bl);
+		} break;
+		case SIDE_BACK: {
+			if (g_ao & SIDE_BOTTOM) {
+				tl -= dark_val;
+				tr -= dark_val;
+			}
+			if (g_ao & SIDE_TOP) {
+				bl -= dark_val;
+				br -= dark_val;
+			}
+			if (g_ao & SIDE_RIGHT) {
+				bl -= dark_val;
+				tl -= dark_val;
+			}
+			if (g_ao & SIDE_LEFT) {
+				br -= dark_val;
+				tr -= dark_val;
+			}
+			out[0] = new_vert(cube_edges[5], offset, tex_id, 0, tl);
+			out[1] = new_vert(cube_edges[4], offset, tex_id, 1, tr);
+			out[2] = new_vert(cube_edges[6], offset, tex_id, 3, br);
+			out[3] = new_vert(cube_edges[5], offset, tex_id, 0, tl);
+			out[4] = new_vert(cube_edges[6], offset, tex_id, 3, br);
+			out[5] = new_vert(cube_edges[7], offset, tex_id, 2, bl);
+		} break;
+	}
+}
+
+// Terrain heights of one chunk column, border included. Shared by every section
+// stacked in that column so streaming vertically never resamples the noise.
+template <typename C>
+struct ChunkColumn {
+	i64 c_x;
+	i64 c_z;
+
+	f32 heights[C::width + 2][C::depth + 2];
+	f32 lowest;
+	f32 highest;
+};
+
+template <typename C>
+void generate_column(ChunkColumn<C> *column, i64 c_x, i64 c_z) {
+	column->c_x = c_x;
+	column->c_z = c_z;
+	column->lowest = FLT_MAX;
+	column->highest = -FLT_MAX;
+
+	for (u32 x = 0; x <= C::width + 1; ++x) {
+		for (u32 z = 0; z <= C::depth + 1; ++z) {
+			f32 column_height = terrain_height(x + c_x * C::width, z + c_z * C::depth);
+			column->heights[x][z] = column_height;
+
+			if (column_height < column->lowest) {
+				column->lowest = column_height;
+			}
+			if (column_height > column->highest) {
+				column->highest = column_height;
+			}
+		}
+	}
+}
+
+// Generates section c_y of the column, y is unbounded in both directions.
+// Sections entirely above or below the terrain surface return without
+// allocating any block data.
+template <typename C>
+C *new_chunk(i64 c_x, i64 c_y, i64 c_z) {
+	counter_add(&metrics.allocations, 1);
+	gauge_add(&metrics.chunks_resident, 1);
+
+	C *chunk = (C *)malloc(sizeof(C));
+
+	chunk->x_off = c_x * C::width;
+	chunk->y_off = c_y * C::height;
+	chunk->z_off = c_z * C::depth;
+	chunk->blocks = NULL;
+	chunk->fill = 0;
+	chunk->mesh = NULL;
+	chunk->mesh_size = 0;
+	memset(chunk->bucket_start, 0, sizeof(chunk->bucket_start));
+	chunk->ticks = NULL;
+	chunk->num_ticks = 0;
+	chunk->ticks_capacity = 0;
+	chunk->evicted = BLOCKS_RESIDENT;
+	chunk->packed = NULL;
+	chunk->packed_size = 0;
+	chunk->pristine = false;
+	chunk->last_used = budget_frame;
+
+	return chunk;
+}
+
+template <typename C>
+void chunk_alloc_blocks(C *chunk) {
+	chunk->blocks = (typename C::Slice *)malloc(sizeof(typename C::Slice) * (C::width + 2));
+	memset(chunk->blocks, 0, sizeof(typename C::Slice) * (C::width + 2));
+
+	counter_add(&metrics.allocations, 1);
+	gauge_add(&metrics.chunks_with_blocks, 1);
+	gauge_add(&metrics.block_bytes, sizeof(typename C::Slice) * (C::width + 2));
+}
+
+template <typename C>
+C *generate_chunk(ChunkColumn<C> *column, i64 c_y) {
+	ScopedTimer timer(&metrics.generate_time);
+	counter_add(&metrics.chunks_generated, 1);
+
+	C *chunk = new_chunk<C>(column->c_x, c_y, column->c_z);
+	chunk->pristine = true;
+
+	if ((f32)chunk->y_off >= column->highest) {
+		return chunk;
+	}
+
+	if ((f32)(chunk->y_off + C::height + 1) < column->lowest) {
+		chunk->fill = 1;
+		return chunk;
+	}
+
+	chunk_alloc_blocks(chunk);
+
+	for (u32 x = 0; x <= C::width + 1; ++x) {
+		for (u32 z = 0; z <= C::depth + 1; ++z) {
+			for (u32 y = 0; y <= C::height + 1; ++y) {
+				i64 world_y = chunk->y_off + y;
+				if ((f32)world_y >= column->heights[x][z]) {
+					break;
+				}
+				chunk->blocks[x][y][z] = block_for_height(world_y);
+			}
+		}
+	}
+
+	return chunk;
+}
+
+template <typename C>
+C *generate_chunk(i64 c_x, i64 c_y, i64 c_z) {
+	ChunkColumn<C> column;
+	generate_column(&column, c_x, c_z);
+	return generate_chunk(&column, c_y);
+}
+
+Vertex *bucket_push(MeshBucket *bucket) {
+	if (bucket->size + 6 > bucket->capacity) {
+		bucket->capacity = bucket->capacity ? bucket->capacity * 2 : 6 * 1024;
+		bucket->verts = (Vertex *)realloc(bucket->verts, bucket->capacity * sizeof(Vertex));
+	}
+
+	Vertex *out = bucket->verts + bucket->size;
+	bucket->size += 6;
+	return out;
+}
+
+// Rebuilds the chunk's mesh from scratch, one bucket per face direction, and
+// packs them into a single exactly sized vertex array.
+template <typename C>
+u32 generate_mesh(C *chunk, MeshStats *stats) {
+	ScopedTimer timer(&metrics.mesh_time);
+	counter_add(&metrics.meshes_generated, 1);
+
+	// A dropped mesh has no memory left to reuse
+	u32 old_size = chunk->mesh != NULL ? chunk->mesh_size : 0;
+	chunk->last_used = budget_frame;
+
+	for (u32 d = 0; d < FACE_DIRECTIONS; d++) {
+		mesh_scratch[d].size = 0;
+	}
+
+	u64 face = 0;
+	u64 blocks = 0;
+	if (chunk->blocks != NULL) {
+		for (u32 x = 1; x <= C::width; ++x) {
+			for (u32 y = 1; y <= C::height; ++y) {
+				for (u32 z = 1; z <= C::depth; ++z) {
+					if (chunk->blocks[x][y][z] != 0) {
+						u16 air_neighbors = get_air_neighbors(chunk, x, y, z);
+						if ((air_neighbors & (SIDE_TOP | SIDE_BOTTOM | SIDE_LEFT | SIDE_RIGHT | SIDE_FRONT | SIDE_BACK)) == 0) {
+							continue;
+						}
+
+						if (air_neighbors & SIDE_TOP) {
+							u16 ao_neighbors = get_air_neighbors(chunk, x, y + 1, z);
+							add_face(chunk, SIDE_TOP, x, y, z, ao_neighbors, bucket_push(&mesh_scratch[FACE_TOP]));
+							face += 1;
+						}
+						if (air_neighbors & SIDE_BOTTOM) {
+							u16 ao_neighbors = get_air_neighbors(chunk, x, y - 1, z);
+							add_face(chunk, SIDE_BOTTOM, x, y, z, ao_neighbors, bucket_push(&mesh_scratch[FACE_BOTTOM]));
+							face += 1;
+						}
+						if (air_neighbors & SIDE_LEFT) {
+							u16 ao_neighbors = get_air_neighbors(chunk, x - 1, y, z);
+							add_face(chunk, SIDE_LEFT, x, y, z, ao_neighbors, bucket_push(&mesh_scratch[FACE_LEFT]));
+							face += 1;
+						}
+						if (air_neighbors & SIDE_RIGHT) {
+							u16 ao_neighbors = get_air_neighbors(chunk, x + 1, y, z);
+							add_face(chunk, SIDE_RIGHT, x, y, z, ao_neighbors, bucket_push(&mesh_scratch[FACE_RIGHT]));
+							face += 1;
+						}
+						if (air_neighbors & SIDE_FRONT) {
+							u16 ao_neighbors = get_air_neighbors(chunk, x, y, z + 1);
+							add_face(chunk, SIDE_FRONT, x, y, z, ao_neighbors, bucket_push(&mesh_scratch[FACE_FRONT]));
+							face += 1;
+						}
+						if (air_neighbors & SIDE_BACK) {
+							u16 ao_neighbors = get_air_neighbors(chunk, x, y, z - 1);
+							add_face(chunk, SIDE_BACK, x, y, z, ao_neighbors, bucket_push(&mesh_scratch[FACE_BACK]));
+							face += 1;
+						}
+
+						blocks += 1;
+					}
+				}
+			}
+		}
+	}
+
+	u32 mesh_size = 0;
+	for (u32 d = 0; d < FACE_DIRECTIONS; d++) {
+		chunk->bucket_start[d] = mesh_size;
+		mesh_size += mesh_scratch[d].size;
+	}
+	chunk->bucket_start[FACE_DIRECTIONS] = mesh_size;
+
+	if (mesh_size != old_size) {
+		if (mesh_size == 0) {
+			free(chunk->mesh);
+			chunk->mesh = NULL;
+			counter_add(&metrics.frees, 1);
+		} else {
+			if (chunk->mesh == NULL) {
+				counter_add(&metrics.allocations, 1);
+			}
+			chunk->mesh = (Vertex *)realloc(chunk->mesh, mesh_size * sizeof(Vertex));
+		}
+	}
+	chunk->mesh_size = mesh_size;
+
+	for (u32 d = 0; d < FACE_DIRECTIONS; d++) {
+		if (mesh_scratch[d].size > 0) {
+			memcpy(chunk->mesh + chunk->bucket_start[d], mesh_scratch[d].verts, mesh_scratch[d].size * sizeof(Vertex));
+		}
+	}
+
+	gauge_add(&metrics.mesh_bytes, ((i64)mesh_size - old_size) * sizeof(Vertex));
+	counter_add(&metrics.faces_meshed, face);
+
+	if (stats != NULL) {
+		stats->blocks += blocks;
+		stats->faces += face;
+	}
+
+	return chunk->mesh_size;
+}
+
+template <typename C>
+void free_chunk(C *chunk) {
+	if (chunk->blocks != NULL) {
+		counter_add(&metrics.frees, 1);
+		gauge_add(&metrics.chunks_with_blocks, -1);
+		gauge_add(&metrics.block_bytes, -(i64)(sizeof(typename C::Slice) * (C::width + 2)));
+	}
+	if (chunk->mesh != NULL) {
+		counter_add(&metrics.frees, 1);
+		gauge_add(&metrics.mesh_bytes, -(i64)(chunk->mesh_size * sizeof(Vertex)));
+	}
+	if (chunk->packed != NULL) {
+		counter_add(&metrics.frees, 1);
+		gauge_add(&metrics.packed_block_bytes, -(i64)chunk->packed_size);
+	}
+	counter_add(&metrics.frees, 1);
+	gauge_add(&metrics.chunks_resident, -1);
+
+	free(chunk->blocks);
+	free(chunk->packed);
+	free(chunk->mesh);
+	free(chunk->ticks);
+	free(chunk);
+}
+
+#endif
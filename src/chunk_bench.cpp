@@ -0,0 +1,105 @@
+#include <chrono>
+#include <algorithm>
+
+#define STB_PERLIN_IMPLEMENTATION
+#include "chunk.h"
+
+// Same block volume for every variant, all heights divide 128
+#define BENCH_WIDTH 256
+#define BENCH_MIN_Y -128
+#define BENCH_MAX_Y 256
+
+// Each variant is generated and meshed this many times, the fastest run is reported
+#define BENCH_RUNS 5
+
+f64 elapsed_ms(std::chrono::high_resolution_clock::time_point start) {
+	std::chrono::duration<f64, std::milli> d = std::chrono::high_resolution_clock::now() - start;
+	return d.count();
+}
+
+template <typename C>
+void bench_variant(const char *name) {
+	u32 num_x = BENCH_WIDTH / C::width;
+	u32 num_z = BENCH_WIDTH / C::depth;
+	i64 min_y = floor_div(BENCH_MIN_Y, C::height);
+	u32 num_y = (BENCH_MAX_Y - BENCH_MIN_Y) / C::height;
+	u32 num_chunks = num_x * num_y * num_z;
+
+	C **chunks = (C **)malloc(sizeof(C *) * num_chunks);
+
+	ChunkColumn<C> column;
+	MeshStats stats;
+	std::chrono::high_resolution_clock::time_point start;
+	f64 gen_ms = DBL_MAX;
+	f64 mesh_ms = DBL_MAX;
+
+	for (u32 run = 0; run < BENCH_RUNS; run++) {
+		if (run > 0) {
+			for (u32 i = 0; i < num_chunks; i++) {
+				free_chunk(chunks[i]);
+			}
+		}
+
+		start = std::chrono::high_resolution_clock::now();
+		for (u32 x = 0; x < num_x; x++) {
+			for (u32 z = 0; z < num_z; z++) {
+				generate_column(&column, x, z);
+				for (u32 y = 0; y < num_y; y++) {
+					chunks[COMPRESS_THREE(x, y, z, num_x, num_y)] = generate_chunk(&column, min_y + y);
+				}
+			}
+		}
+		gen_ms = std::min(gen_ms, elapsed_ms(start));
+
+		bzero(&stats, sizeof(MeshStats));
+
+		start = std::chrono::high_resolution_clock::now();
+		for (u32 i = 0; i < num_chunks; i++) {
+			generate_mesh(chunks[i], &stats);
+		}
+		mesh_ms = std::min(mesh_ms, elapsed_ms(start));
+	}
+
+	u32 uniform = 0;
+	u64 block_bytes = 0;
+	u64 mesh_bytes = 0;
+	for (u32 i = 0; i < num_chunks; i++) {
+		if (chunks[i]->blocks == NULL) {
+			uniform++;
+		} else {
+			block_bytes += sizeof(typename C::Slice) * (C::width + 2);
+		}
+		mesh_bytes += chunks[i]->mesh_size * sizeof(Vertex);
+	}
+
+	// Cost of a single edit: remesh one section that actually has geometry
+	u32 remeshed = 0;
+	start = std::chrono::high_resolution_clock::now();
+	for (u32 i = 0; i < num_chunks; i++) {
+		if (chunks[i]->blocks != NULL) {
+			generate_mesh(chunks[i], NULL);
+			remeshed++;
+		}
+	}
+	f64 remesh_ms = elapsed_ms(start);
+
+	printf("%s\n", name);
+	printf("  chunks: %u (%u uniform, no block data)\n", num_chunks, uniform);
+	printf("  generate: %.2f ms (%.1f chunks/s)\n", gen_ms, num_chunks / (gen_ms / 1000.0));
+	printf("  mesh: %.2f ms, %llu faces\n", mesh_ms, (unsigned long long)stats.faces);
+	printf("  generate + mesh: %.1f chunks/s\n", num_chunks / ((gen_ms + mesh_ms) / 1000.0));
+	printf("  remesh unit: %.3f ms\n", remeshed ? remesh_ms / remeshed : 0.0);
+	printf("  block data: %.2f MiB, mesh data: %.2f MiB\n", block_bytes / (1024.0 * 1024.0), mesh_bytes / (1024.0 * 1024.0));
+
+	for (u32 i = 0; i < num_chunks; i++) {
+		free_chunk(chunks[i]);
+	}
+	free(chunks);
+}
+
+int main() {
+	bench_variant<BasicChunk<16, 128, 16> >("16x128x16 columns");
+	bench_variant<BasicChunk<32, 32, 32> >("32x32x32 cubic");
+	bench_variant<BasicChunk<16, 16, 16> >("16x16x16 cubic");
+	return 0;
+}
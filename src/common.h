@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <strings.h>
 
 typedef uint64_t u64;
 typedef uint32_t u32;
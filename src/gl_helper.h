@@ -9,7 +9,7 @@
 #if RELEASE
 #define GL_CHECK(x) x
 #else
-#define GL_CHECK(x) do { x; GLenum err = glGetError(); assert(err == GL_NO_ERROR); } while(0)
+#define GL_CHECK(x) do { x; GLenum err = glGetError(); assert(err == GL_NO_ERROR); (void)err; } while(0)
 #endif
 
 void get_shader_err(GLuint shader) {
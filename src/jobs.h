@@ -0,0 +1,125 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+
+#include "common.h"
+
+// Persistent worker threads for data parallel per-frame work. job_pool_run()
+// hands out task indices to the workers and the calling thread alike, and
+// returns once every task has finished.
+
+typedef struct JobPool {
+	std::vector<std::thread> threads;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable finished;
+
+	std::function<void(u32)> task;
+	u32 num_tasks;
+	std::atomic<u32> next;
+	u32 remaining;
+
+	// Workers inside job_pool_work(), a run only ends once they have all left it
+	u32 active;
+
+	u64 generation;
+	bool quit;
+} JobPool;
+
+void job_pool_work(JobPool *pool) {
+	for (;;) {
+		u32 i = pool->next.fetch_add(1);
+		if (i >= pool->num_tasks) {
+			break;
+		}
+
+		pool->task(i);
+
+		std::lock_guard<std::mutex> guard(pool->lock);
+		if (--pool->remaining == 0) {
+			pool->finished.notify_all();
+		}
+	}
+}
+
+void job_pool_worker(JobPool *pool) {
+	u64 seen = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> guard(pool->lock);
+			pool->wake.wait(guard, [&]() { return pool->quit || pool->generation != seen; });
+			if (pool->quit) {
+				return;
+			}
+			seen = pool->generation;
+			pool->active++;
+		}
+
+		job_pool_work(pool);
+
+		std::lock_guard<std::mutex> guard(pool->lock);
+		if (--pool->active == 0) {
+			pool->finished.notify_all();
+		}
+	}
+}
+
+// threads is the number of extra workers, 0 runs everything on the caller
+void job_pool_start(JobPool *pool, u32 threads) {
+	pool->num_tasks = 0;
+	pool->next = 0;
+	pool->remaining = 0;
+	pool->active = 0;
+	pool->generation = 0;
+	pool->quit = false;
+
+	for (u32 i = 0; i < threads; i++) {
+		pool->threads.push_back(std::thread(job_pool_worker, pool));
+	}
+}
+
+void job_pool_run(JobPool *pool, u32 num_tasks, std::function<void(u32)> task) {
+	if (num_tasks == 0) {
+		return;
+	}
+
+	{
+		// A worker that woke too late for the previous run may still be on its way out
+		std::unique_lock<std::mutex> guard(pool->lock);
+		pool->finished.wait(guard, [&]() { return pool->active == 0; });
+
+		pool->task = task;
+		pool->num_tasks = num_tasks;
+		pool->remaining = num_tasks;
+		pool->next = 0;
+		pool->generation++;
+	}
+	pool->wake.notify_all();
+
+	job_pool_work(pool);
+
+	std::unique_lock<std::mutex> guard(pool->lock);
+	pool->finished.wait(guard, [&]() { return pool->remaining == 0 && pool->active == 0; });
+}
+
+void job_pool_stop(JobPool *pool) {
+	{
+		std::lock_guard<std::mutex> guard(pool->lock);
+		pool->quit = true;
+	}
+	pool->wake.notify_all();
+
+	for (u32 i = 0; i < pool->threads.size(); i++) {
+		pool->threads[i].join();
+	}
+	pool->threads.clear();
+}
+
+#endif
@@ -1,32 +1,69 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
+#ifdef __APPLE__
 #include <OpenGL/gl3.h>
+#else
+// libGL exports the core profile entry points, so no separate loader is needed
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glcorearb.h>
+#endif
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-#define STB_PERLIN_IMPLEMENTATION
-#include "stb_perlin.h"
+#include <algorithm>
 
 #include "common.h"
 #include "gl_helper.h"
 
-#define CHUNK_WIDTH 16
-#define CHUNK_HEIGHT 128
-#define CHUNK_DEPTH 16
-
-#define NUM_X_CHUNKS 13
-#define NUM_Z_CHUNKS 13
-
-glm::vec3 cube_edges[] = {
-	glm::vec3(-0.0f, -0.0f,  1.0f),
-	glm::vec3( 1.0f, -0.0f,  1.0f),
-	glm::vec3(-0.0f,  1.0f,  1.0f),
-	glm::vec3( 1.0f,  1.0f,  1.0f),
-	glm::vec3(-0.0f, -0.0f, -0.0f),
-	glm::vec3( 1.0f, -0.0f, -0.0f),
-	glm::vec3(-0.0f,  1.0f, -0.0f),
-	glm::vec3( 1.0f,  1.0f, -0.0f),
-};
+#define STB_PERLIN_IMPLEMENTATION
+#include "chunk.h"
+#include "world_file.h"
+#include "snow.h"
+#include "snow_cover.h"
+#include "ticks.h"
+#include "budget.h"
+#include "occlusion.h"
+#include "world_render.h"
+#include "world_server.h"
+
+#define METRICS_INTERVAL_MS 1000
+
+// Extent of the loaded world in blocks, the vertical window follows the camera.
+// Override with e.g. -DVIEW_WIDTH=416 and cap what it takes with the SNOW_*_BUDGET variables.
+#ifndef VIEW_WIDTH
+#define VIEW_WIDTH 208
+#endif
+#ifndef VIEW_HEIGHT
+#define VIEW_HEIGHT 256
+#endif
+
+#define NUM_X_CHUNKS (VIEW_WIDTH / CHUNK_WIDTH)
+#define NUM_Y_CHUNKS (VIEW_HEIGHT / CHUNK_HEIGHT + 1)
+#define NUM_Z_CHUNKS (VIEW_WIDTH / CHUNK_DEPTH)
+
+// How long the idle loop blocks waiting for input before waking up anyway
+#define IDLE_WAIT_MS 250
+
+// In idle mode, frames where only falling snow moves are drawn at most this often
+#define ANIMATION_FRAME_MS 33
+
+// Longest step the camera and simulations take in one frame, so an idle wait or
+// a stall doesn't turn into one big jump
+#define MAX_FRAME_MS 100
+
+// Room left after each chunk's mesh in the vertex buffer, so a remesh after a
+// block tick can usually be uploaded in place
+#define MESH_SLACK(size) ((size) / 4 + 6 * 64)
+
+// How far the camera moves before a world server is told, so it can reorder what it sends
+#define VIEWER_UPDATE_DISTANCE 8.0f
+
+// How long the idle loop waits between checks while sections from a world server are due
+#define SERVER_WAIT_MS 5
+
+// Flakes kept around the camera, override with SNOW_FLAKES
+#define SNOW_DEFAULT_FLAKES 200000
+#define SNOW_FLAKE_SIZE 0.15f
 
 typedef struct KeyHandler {
 	bool up;
@@ -35,389 +72,690 @@ typedef struct KeyHandler {
 	bool right;
 } KeyHandler;
 
-typedef struct Vertex {
-	glm::vec3 point;
-	u8 t_point;
-	u8 tex_id;
-	u8 ao;
-} Vertex;
-
-typedef struct Chunk {
-	u8 blocks[CHUNK_WIDTH + 2][CHUNK_HEIGHT + 2][CHUNK_DEPTH + 2];
-
-	Vertex *mesh;
-	u32 mesh_size;
-
-	u64 x_off;
-	u64 z_off;
-} Chunk;
-
-Vertex new_vert(glm::vec3 edge, glm::vec3 offset, u8 tex_id, u8 t_point, u8 ao) {
-	Vertex v;
-	v.point = edge + offset;
-	v.t_point = t_point;
-	v.tex_id = tex_id;
-	v.ao = ao;
-	return v;
+// Tracks what changed since the last presented frame so idle mode can skip redraws
+typedef struct FrameState {
+	bool idle_mode;
+	bool window_dirty;
+	bool world_dirty;
+
+	// Something on screen moves by itself, e.g. falling snow, so every frame is drawn
+	bool animating;
+
+	glm::vec3 last_cam_pos;
+	glm::vec3 last_cam_front;
+	u64 last_present_ns;
+
+	u64 frames_drawn;
+	u64 frames_skipped;
+	// Time spent rendering and presenting the frames drawn, idle waits aren't in it
+	u64 frame_ns;
+	u64 total_frames_skipped;
+
+	DrawStats draw;
+
+	u64 snow_ns;
+	u64 snow_flakes;
+	u64 snow_upload_bytes;
+
+	u64 cover_ns;
+	u64 cover_ticks;
+	u64 cover_upload_bytes;
+
+	u64 tick_ns;
+	u64 tick_chunk_ns;
+	u64 ticks_run;
+	u64 chunks_ticked;
+	u64 blocks_changed;
+	u64 chunks_remeshed;
+	u64 mesh_upload_bytes;
+
+	u64 sections_received;
+	u64 deltas_received;
+
+	// Memory budget totals at the last readout, for the rates since
+	u64 evictions_seen[BUDGET_TIERS];
+	u64 restores_seen;
+	u64 kept_evictions_seen;
+
+	// Occlusion culling totals at the last readout, and the pixels drawn per
+	// frame the last time it was off
+	u64 samples_seen;
+	u64 hidden_seen;
+	u64 skipped_seen;
+	u64 vertices_skipped_seen;
+	f64 unculled_samples;
+} FrameState;
+
+// The camera moves while these are held, without any event arriving
+bool movement_keys_held() {
+	const u8 *state = SDL_GetKeyboardState(NULL);
+	return state[SDL_SCANCODE_W] || state[SDL_SCANCODE_S] || state[SDL_SCANCODE_A] || state[SDL_SCANCODE_D];
 }
 
-enum {
-	SIDE_FRONT    = 0b0000000001,
-	SIDE_BACK     = 0b0000000010,
-	SIDE_TOP      = 0b0000000100,
-	SIDE_BOTTOM   = 0b0000001000,
-	SIDE_LEFT     = 0b0000010000,
-	SIDE_RIGHT    = 0b0000100000,
-	SIDE_TL_DIAG  = 0b0001000000,
-	SIDE_TR_DIAG  = 0b0010000000,
-	SIDE_BL_DIAG  = 0b0100000000,
-	SIDE_BR_DIAG  = 0b1000000000,
-};
+bool frame_needs_redraw(FrameState *frame, glm::vec3 cam_pos, glm::vec3 cam_front) {
+	if (!frame->idle_mode || frame->window_dirty || frame->world_dirty || movement_keys_held()) {
+		return true;
+	}
+	if (cam_pos != frame->last_cam_pos || cam_front != frame->last_cam_front) {
+		return true;
+	}
 
-u16 get_air_neighbors(Chunk *chunk, u32 x, u32 y, u32 z) {
-	u16 neighbors = 0;
+	// Nothing but the snow moves, which doesn't need every frame the GPU can draw
+	return frame->animating && metrics_now_ns() - frame->last_present_ns >= (u64)ANIMATION_FRAME_MS * 1000000;
+}
 
-    if (x == 0 || y == 0 || z == 0 || x > CHUNK_WIDTH || y > CHUNK_HEIGHT || z > CHUNK_DEPTH) {
-		return neighbors;
+// How long the idle loop can block before a frame is due without input
+u32 frame_idle_wait_ms(FrameState *frame) {
+	if (!frame->animating) {
+		return IDLE_WAIT_MS;
 	}
 
-	if (chunk->blocks[x - 1][y][z] == 0) {
-		neighbors |= SIDE_LEFT;
-	}
-	if (chunk->blocks[x + 1][y][z] == 0) {
-		neighbors |= SIDE_RIGHT;
-	}
-	if (chunk->blocks[x][y + 1][z] == 0) {
-		neighbors |= SIDE_TOP;
-	}
-	if (chunk->blocks[x][y - 1][z] == 0) {
-		neighbors |= SIDE_BOTTOM;
-	}
-	if (chunk->blocks[x][y][z + 1] == 0) {
-		neighbors |= SIDE_FRONT;
+	u64 since = (metrics_now_ns() - frame->last_present_ns) / 1000000;
+	return since < ANIMATION_FRAME_MS ? ANIMATION_FRAME_MS - since : 0;
+}
+
+void frame_presented(FrameState *frame, glm::vec3 cam_pos, glm::vec3 cam_front) {
+	frame->window_dirty = false;
+	frame->world_dirty = false;
+	frame->last_cam_pos = cam_pos;
+	frame->last_cam_front = cam_front;
+	frame->last_present_ns = metrics_now_ns();
+	frame->frames_drawn++;
+}
+
+typedef SnowCover<Chunk::width, Chunk::depth> ChunkCover;
+
+typedef struct World {
+	Chunk *chunks[NUM_X_CHUNKS * NUM_Y_CHUNKS * NUM_Z_CHUNKS];
+
+	// First vertex of each chunk's mesh in the vertex buffer, and how many it has
+	// room for. Chunks the GPU budget left out of the buffer aren't drawn.
+	u32 draw_first[NUM_X_CHUNKS * NUM_Y_CHUNKS * NUM_Z_CHUNKS];
+	u32 draw_capacity[NUM_X_CHUNKS * NUM_Y_CHUNKS * NUM_Z_CHUNKS];
+	bool on_gpu[NUM_X_CHUNKS * NUM_Y_CHUNKS * NUM_Z_CHUNKS];
+	u64 buffer_size;
+
+	ChunkColumn<Chunk> columns[NUM_X_CHUNKS * NUM_Z_CHUNKS];
+
+	// Snow lying on each chunk column, kept while sections stream in and out below it
+	ChunkCover covers[NUM_X_CHUNKS * NUM_Z_CHUNKS];
+
+	// Section y of the lowest loaded layer
+	i64 y_base;
+
+	// Pre-generated columns are loaded from here instead of being generated, may be NULL
+	const char *baked_dir;
+
+	// Sections come from this world server instead when connected, may be NULL
+	WorldClient *server;
+	glm::vec3 viewer_sent;
+
+	// Slots holding an empty stand-in until the server's section arrives
+	bool waiting[NUM_X_CHUNKS * NUM_Y_CHUNKS * NUM_Z_CHUNKS];
+	u32 num_waiting;
+
+	// Gathered while streaming and sent to the server together
+	SectionPos requests[NUM_X_CHUNKS * NUM_Y_CHUNKS * NUM_Z_CHUNKS];
+	u32 num_requests;
+	SectionPos drops[NUM_X_CHUNKS * NUM_Y_CHUNKS * NUM_Z_CHUNKS];
+	u32 num_drops;
+
+	MeshStats stats;
+	MemoryBudget budget;
+} World;
+
+Chunk **world_chunk(World *world, u32 x, u32 y, u32 z) {
+	return &world->chunks[COMPRESS_THREE(x, y, z, NUM_X_CHUNKS, NUM_Y_CHUNKS)];
+}
+
+// Lowest section of the vertical window centred on the camera
+i64 section_window_base(glm::vec3 cam_pos) {
+	return floor_div((i64)floorf(cam_pos.y) - 1, CHUNK_HEIGHT) - NUM_Y_CHUNKS / 2;
+}
+
+Chunk *load_section(World *world, u32 x, u32 y, u32 z) {
+	if (world->server != NULL) {
+		SectionPos pos = { (i32)x, (i32)(world->y_base + y), (i32)z };
+		world->requests[world->num_requests++] = pos;
+		world->waiting[COMPRESS_THREE(x, y, z, NUM_X_CHUNKS, NUM_Y_CHUNKS)] = true;
+		world->num_waiting++;
+		return new_chunk<Chunk>(x, world->y_base + y, z);
 	}
-	if (chunk->blocks[x][y][z - 1] == 0) {
-		neighbors |= SIDE_BACK;
+
+	if (world->baked_dir != NULL) {
+		Chunk *chunk = read_section<Chunk>(world->baked_dir, x, world->y_base + y, z);
+		if (chunk != NULL) {
+			return chunk;
+		}
 	}
 
-	if (chunk->blocks[x - 1][y][z - 1] == 0) {
-		neighbors |= SIDE_BL_DIAG;
+	Chunk *chunk = generate_chunk(&world->columns[COMPRESS_TWO(x, z, NUM_X_CHUNKS)], world->y_base + y);
+	generate_mesh(chunk, &world->stats);
+	return chunk;
+}
+
+// Sends the drops and requests gathered by load_section() and stream_world()
+void request_sections(World *world) {
+	if (world->server == NULL) {
+		return;
 	}
-	if (chunk->blocks[x + 1][y][z - 1] == 0) {
-		neighbors |= SIDE_BR_DIAG;
+
+	world_client_drop(world->server, world->drops, world->num_drops);
+	world_client_request(world->server, world->requests, world->num_requests);
+	world->num_drops = 0;
+	world->num_requests = 0;
+}
+
+// Lets the server serve the sections nearest the camera first
+void viewer_moved(World *world, glm::vec3 cam_pos) {
+	if (world->server != NULL && glm::length(cam_pos - world->viewer_sent) >= VIEWER_UPDATE_DISTANCE) {
+		world_client_viewer(world->server, cam_pos.x, cam_pos.y, cam_pos.z);
+		world->viewer_sent = cam_pos;
 	}
-	if (chunk->blocks[x - 1][y][z + 1] == 0) {
-		neighbors |= SIDE_TL_DIAG;
+}
+
+void load_world(World *world, i64 y_base) {
+	world->y_base = y_base;
+	bzero(&world->stats, sizeof(MeshStats));
+	bzero(world->waiting, sizeof(world->waiting));
+	bzero(world->on_gpu, sizeof(world->on_gpu));
+	world->num_waiting = 0;
+	world->num_requests = 0;
+	world->num_drops = 0;
+
+	for (u32 x = 0; x < NUM_X_CHUNKS; x++) {
+		for (u32 z = 0; z < NUM_Z_CHUNKS; z++) {
+			generate_column(&world->columns[COMPRESS_TWO(x, z, NUM_X_CHUNKS)], x, z);
+			snow_cover_init(&world->covers[COMPRESS_TWO(x, z, NUM_X_CHUNKS)], x * Chunk::width + 1, z * Chunk::depth + 1);
+		}
 	}
-	if (chunk->blocks[x + 1][y][z + 1] == 0) {
-		neighbors |= SIDE_TR_DIAG;
+
+	for (u32 x = 0; x < NUM_X_CHUNKS; x++) {
+		for (u32 y = 0; y < NUM_Y_CHUNKS; y++) {
+			for (u32 z = 0; z < NUM_Z_CHUNKS; z++) {
+				*world_chunk(world, x, y, z) = load_section(world, x, y, z);
+			}
+		}
 	}
 
-	return neighbors;
+	request_sections(world);
 }
 
-void add_face(Chunk *chunk, u16 side, u32 x, u32 y, u32 z, u16 neighbors) {
-	glm::vec3 offset = glm::vec3(x + (chunk->x_off), y, z + (chunk->z_off));
-	u8 tex_id = chunk->blocks[x][y][z];
-
-	u64 mesh_size = chunk->mesh_size;
-
-	u16 g_ao = ~neighbors;
-	u8 ao = 255;
-	u8 tl = ao;
-	u8 tr = ao;
-	u8 bl = ao;
-	u8 br = ao;
-	u8 dark_val = 50;
-
-	switch (side) {
-		case SIDE_TOP: {
-			if (g_ao & SIDE_FRONT) {
-				tl -= dark_val;
-				tr -= dark_val;
-			}
-			if (g_ao & SIDE_BACK) {
-				bl -= dark_val;
-				br -= dark_val;
-			}
-			if (g_ao & SIDE_LEFT) {
-				bl -= dark_val;
-				tl -= dark_val;
-			}
-			if (g_ao & SIDE_RIGHT) {
-				br -= dark_val;
-				tr -= dark_val;
-			}
+// Slides the vertical window so it stays centred on the camera, keeping the
+// sections that are still in range and generating only the newly exposed layers.
+// Returns true when the world's geometry changed.
+bool stream_world(World *world, i64 y_base) {
+	if (y_base == world->y_base) {
+		return false;
+	}
 
-			if (g_ao & SIDE_TR_DIAG) {
-				tr -= dark_val;
-			}
-			if (g_ao & SIDE_TL_DIAG) {
-				tl -= dark_val;
-			}
-			if (g_ao & SIDE_BL_DIAG) {
-				bl -= dark_val;
-			}
-			if (g_ao & SIDE_BR_DIAG) {
-				br -= dark_val;
-			}
+	i64 shift = y_base - world->y_base;
+	i64 old_base = world->y_base;
+	world->y_base = y_base;
 
-			if (tr + bl > br + tl) {
-				chunk->mesh[mesh_size    ] = new_vert(cube_edges[2], offset, tex_id, 0, tl);
-				chunk->mesh[mesh_size + 1] = new_vert(cube_edges[3], offset, tex_id, 1, tr);
-				chunk->mesh[mesh_size + 2] = new_vert(cube_edges[6], offset, tex_id, 2, bl);
-				chunk->mesh[mesh_size + 3] = new_vert(cube_edges[3], offset, tex_id, 1, tr);
-				chunk->mesh[mesh_size + 4] = new_vert(cube_edges[7], offset, tex_id, 3, br);
-				chunk->mesh[mesh_size + 5] = new_vert(cube_edges[6], offset, tex_id, 2, bl);
-			} else {
-				chunk->mesh[mesh_size    ] = new_vert(cube_edges[2], offset, tex_id, 0, tl);
-				chunk->mesh[mesh_size + 1] = new_vert(cube_edges[3], offset, tex_id, 1, tr);
-				chunk->mesh[mesh_size + 2] = new_vert(cube_edges[7], offset, tex_id, 3, br);
-				chunk->mesh[mesh_size + 3] = new_vert(cube_edges[2], offset, tex_id, 0, tl);
-				chunk->mesh[mesh_size + 4] = new_vert(cube_edges[7], offset, tex_id, 3, br);
-				chunk->mesh[mesh_size + 5] = new_vert(cube_edges[6], offset, tex_id, 2, bl);
-			}
+	i64 layers = shift < 0 ? -shift : shift;
+	if (layers > NUM_Y_CHUNKS) {
+		layers = NUM_Y_CHUNKS;
+	}
 
-		} break;
-		case SIDE_BOTTOM: {
-			if (g_ao & SIDE_BACK) {
-				tl -= dark_val;
-				tr -= dark_val;
-			}
-			if (g_ao & SIDE_FRONT) {
-				bl -= dark_val;
-				br -= dark_val;
-			}
-			if (g_ao & SIDE_LEFT) {
-				bl -= dark_val;
-				tl -= dark_val;
-			}
-			if (g_ao & SIDE_RIGHT) {
-				br -= dark_val;
-				tr -= dark_val;
+	for (u32 x = 0; x < NUM_X_CHUNKS; x++) {
+		for (u32 z = 0; z < NUM_Z_CHUNKS; z++) {
+			// Kept sections take where their vertices are along, the buffer is laid out again from it
+			Chunk *column[NUM_Y_CHUNKS];
+			bool waiting[NUM_Y_CHUNKS];
+			bool on_gpu[NUM_Y_CHUNKS];
+			u32 draw_first[NUM_Y_CHUNKS];
+			for (u32 y = 0; y < NUM_Y_CHUNKS; y++) {
+				u32 i = COMPRESS_THREE(x, y, z, NUM_X_CHUNKS, NUM_Y_CHUNKS);
+				column[y] = world->chunks[i];
+				waiting[y] = world->waiting[i];
+				on_gpu[y] = world->on_gpu[i];
+				draw_first[y] = world->draw_first[i];
+				world->waiting[i] = false;
+				world->on_gpu[i] = false;
 			}
 
-			chunk->mesh[mesh_size    ] = new_vert(cube_edges[4], offset, tex_id, 0, tl);
-			chunk->mesh[mesh_size + 1] = new_vert(cube_edges[5], offset, tex_id, 1, tr);
-			chunk->mesh[mesh_size + 2] = new_vert(cube_edges[1], offset, tex_id, 3, br);
-			chunk->mesh[mesh_size + 3] = new_vert(cube_edges[4], offset, tex_id, 0, tl);
-			chunk->mesh[mesh_size + 4] = new_vert(cube_edges[1], offset, tex_id, 3, br);
-			chunk->mesh[mesh_size + 5] = new_vert(cube_edges[0], offset, tex_id, 2, bl);
-		} break;
-		case SIDE_LEFT: {
-			if (g_ao & SIDE_BOTTOM) {
-				tl -= dark_val;
-				tr -= dark_val;
-			}
-			if (g_ao & SIDE_TOP) {
-				bl -= dark_val;
-				br -= dark_val;
-			}
-			if (g_ao & SIDE_BACK) {
-				bl -= dark_val;
-				tl -= dark_val;
-			}
-			if (g_ao & SIDE_FRONT) {
-				br -= dark_val;
-				tr -= dark_val;
+			for (u32 y = 0; y < NUM_Y_CHUNKS; y++) {
+				i64 old_y = y + shift;
+				if (old_y >= 0 && old_y < NUM_Y_CHUNKS) {
+					u32 i = COMPRESS_THREE(x, y, z, NUM_X_CHUNKS, NUM_Y_CHUNKS);
+					world->chunks[i] = column[old_y];
+					world->waiting[i] = waiting[old_y];
+					world->on_gpu[i] = on_gpu[old_y];
+					world->draw_first[i] = draw_first[old_y];
+					column[old_y] = NULL;
+				} else {
+					*world_chunk(world, x, y, z) = load_section(world, x, y, z);
+				}
 			}
 
-			chunk->mesh[mesh_size    ] = new_vert(cube_edges[4], offset, tex_id, 0, tl);
-			chunk->mesh[mesh_size + 1] = new_vert(cube_edges[0], offset, tex_id, 1, tr);
-			chunk->mesh[mesh_size + 2] = new_vert(cube_edges[2], offset, tex_id, 3, br);
-			chunk->mesh[mesh_size + 3] = new_vert(cube_edges[4], offset, tex_id, 0, tl);
-			chunk->mesh[mesh_size + 4] = new_vert(cube_edges[2], offset, tex_id, 3, br);
-			chunk->mesh[mesh_size + 5] = new_vert(cube_edges[6], offset, tex_id, 2, bl);
-		} break;
-		case SIDE_RIGHT: {
-			if (g_ao & SIDE_BOTTOM) {
-				tl -= dark_val;
-				tr -= dark_val;
-			}
-			if (g_ao & SIDE_TOP) {
-				bl -= dark_val;
-				br -= dark_val;
-			}
-			if (g_ao & SIDE_FRONT) {
-				bl -= dark_val;
-				tl -= dark_val;
-			}
-			if (g_ao & SIDE_BACK) {
-				br -= dark_val;
-				tr -= dark_val;
-			}
-			chunk->mesh[mesh_size    ] = new_vert(cube_edges[1], offset, tex_id, 0, tl);
-			chunk->mesh[mesh_size + 1] = new_vert(cube_edges[5], offset, tex_id, 1, tr);
-			chunk->mesh[mesh_size + 2] = new_vert(cube_edges[7], offset, tex_id, 3, br);
-			chunk->mesh[mesh_size + 3] = new_vert(cube_edges[1], offset, tex_id, 0, tl);
-			chunk->mesh[mesh_size + 4] = new_vert(cube_edges[7], offset, tex_id, 3, br);
-			chunk->mesh[mesh_size + 5] = new_vert(cube_edges[3], offset, tex_id, 2, bl);
-		} break;
-		case SIDE_FRONT: {
-			if (g_ao & SIDE_BOTTOM) {
-				tl -= dark_val;
-				tr -= dark_val;
-			}
-			if (g_ao & SIDE_TOP) {
-				bl -= dark_val;
-				br -= dark_val;
-			}
-			if (g_ao & SIDE_LEFT) {
-				bl -= dark_val;
-				tl -= dark_val;
-			}
-			if (g_ao & SIDE_RIGHT) {
-				br -= dark_val;
-				tr -= dark_val;
-			}
-			chunk->mesh[mesh_size    ] = new_vert(cube_edges[0], offset, tex_id, 0, tl);
-			chunk->mesh[mesh_size + 1] = new_vert(cube_edges[1], offset, tex_id, 1, tr);
-			chunk->mesh[mesh_size + 2] = new_vert(cube_edges[3], offset, tex_id, 3, br);
-			chunk->mesh[mesh_size + 3] = new_vert(cube_edges[0], offset, tex_id, 0, tl);
-			chunk->mesh[mesh_size + 4] = new_vert(cube_edges[3], offset, tex_id, 3, br);
-			chunk->mesh[mesh_size + 5] = new_vert(cube_edges[2], offset, tex_id, 2, bl);
-		} break;
-		case SIDE_BACK: {
-			if (g_ao & SIDE_BOTTOM) {
-				tl -= dark_val;
-				tr -= dark_val;
-			}
-			if (g_ao & SIDE_TOP) {
-				bl -= dark_val;
-				br -= dark_val;
-			}
-			if (g_ao & SIDE_RIGHT) {
-				bl -= dark_val;
-				tl -= dark_val;
-			}
-			if (g_ao & SIDE_LEFT) {
-				br -= dark_val;
-				tr -= dark_val;
+			for (u32 y = 0; y < NUM_Y_CHUNKS; y++) {
+				if (column[y] == NULL) {
+					continue;
+				}
+
+				// Whether it arrived or not, the server can forget it
+				if (world->server != NULL) {
+					SectionPos pos = { (i32)x, (i32)(old_base + y), (i32)z };
+					world->drops[world->num_drops++] = pos;
+					world->num_waiting -= waiting[y];
+				}
+				free_chunk(column[y]);
 			}
-			chunk->mesh[mesh_size    ] = new_vert(cube_edges[5], offset, tex_id, 0, tl);
-			chunk->mesh[mesh_size + 1] = new_vert(cube_edges[4], offset, tex_id, 1, tr);
-			chunk->mesh[mesh_size + 2] = new_vert(cube_edges[6], offset, tex_id, 3, br);
-			chunk->mesh[mesh_size + 3] = new_vert(cube_edges[5], offset, tex_id, 0, tl);
-			chunk->mesh[mesh_size + 4] = new_vert(cube_edges[6], offset, tex_id, 3, br);
-			chunk->mesh[mesh_size + 5] = new_vert(cube_edges[7], offset, tex_id, 2, bl);
-		} break;
+		}
 	}
 
-	chunk->mesh_size += 6;
+	request_sections(world);
+	return true;
 }
 
-Chunk *generate_chunk(u32 x_off, u32 z_off) {
-	Chunk *chunk = (Chunk *)malloc(sizeof(Chunk));
-	memset(chunk->blocks, 0, sizeof(chunk->blocks));
+// Lays every section's mesh out in the single vertex buffer, each followed by
+// MESH_SLACK spare vertices, nearest first as far as the GPU budget goes. Meshes
+// the budget dropped from memory are copied over from the old buffer, or built
+// again when they weren't in it. Returns the vertex count.
+u64 upload_world(World *world, glm::vec3 cam_pos) {
+	ScopedTimer timer(&metrics.upload_time);
+
+	u32 count = ARRAY_SIZE(world->chunks);
+	u32 capacity[ARRAY_SIZE(world->chunks)];
+	bool placed[ARRAY_SIZE(world->chunks)];
+	for (u32 i = 0; i < count; i++) {
+		// Uniform sections have no blocks to change, so no room is kept for them
+		u32 mesh_size = world->chunks[i]->mesh_size;
+		capacity[i] = mesh_size + (world->chunks[i]->blocks ? MESH_SLACK(mesh_size) : 0);
+	}
+	budget_place(&world->budget, world->chunks, capacity, world->on_gpu, placed, cam_pos);
+
+	// Respecifying the buffer loses its contents, so what's still needed from it goes to a copy first
+	GLuint old_buffer = 0;
+	for (u32 i = 0; i < count && old_buffer == 0; i++) {
+		if (placed[i] && world->on_gpu[i] && chunk_mesh_dropped(world->chunks[i])) {
+			glGenBuffers(1, &old_buffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, old_buffer);
+			glBufferData(GL_COPY_WRITE_BUFFER, world->buffer_size * sizeof(Vertex), NULL, GL_STREAM_COPY);
+			glCopyBufferSubData(GL_ARRAY_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, world->buffer_size * sizeof(Vertex));
+			glBindBuffer(GL_COPY_READ_BUFFER, old_buffer);
+		}
+	}
 
-	chunk->x_off = x_off * (CHUNK_WIDTH);
-	chunk->z_off = z_off * (CHUNK_DEPTH);
-	chunk->mesh_size = 0;
-	chunk->mesh = NULL;
+	u64 total_mesh_size = 0;
+	u64 uploaded = 0;
+	u64 buffer_size = 0;
+	for (u32 i = 0; i < count; i++) {
+		buffer_size += placed[i] ? capacity[i] : 0;
+	}
 
-	f32 min_height = CHUNK_HEIGHT / 6;
-	f32 avg_height = CHUNK_HEIGHT / 3;
+	glBufferData(GL_ARRAY_BUFFER, buffer_size * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+	u64 mesh_indent = 0;
+	for (u32 i = 0; i < count; i++) {
+		Chunk *chunk = world->chunks[i];
+		u64 mesh_size = chunk->mesh_size;
+		u32 old_first = world->draw_first[i];
+		bool was_on_gpu = world->on_gpu[i];
+
+		world->on_gpu[i] = placed[i];
+		if (!placed[i]) {
+			world->draw_capacity[i] = 0;
+			continue;
+		}
 
-	for (u32 x = 0; x <= CHUNK_WIDTH + 1; ++x) {
-		for (u32 z = 0; z <= CHUNK_DEPTH + 1; ++z) {
+		world->draw_first[i] = mesh_indent;
+		world->draw_capacity[i] = capacity[i];
+		mesh_indent += capacity[i];
+		total_mesh_size += mesh_size;
+		if (mesh_size == 0) {
+			continue;
+		}
 
-			f32 column_height = avg_height;
-			for (u8 o = 5; o < 8; o++) {
-				f32 scale = (f32)(2 << o) * 1.01f;
-				column_height += (f32)(o << 3) * stb_perlin_noise3((f32)(x + chunk->x_off) / scale, (f32)(z + chunk->z_off) / scale, o * 2.0f, 256, 256, 256);
+		if (chunk_mesh_dropped(chunk) && was_on_gpu) {
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, old_first * sizeof(Vertex), world->draw_first[i] * sizeof(Vertex), mesh_size * sizeof(Vertex));
+			continue;
+		}
+
+		chunk_restore(chunk);
+		glBufferSubData(GL_ARRAY_BUFFER, world->draw_first[i] * sizeof(Vertex), mesh_size * sizeof(Vertex), chunk->mesh);
+		uploaded += mesh_size;
+	}
+
+	if (old_buffer != 0) {
+		glDeleteBuffers(1, &old_buffer);
+	}
+	world->buffer_size = buffer_size;
+
+	counter_add(&metrics.uploads, 1);
+	counter_add(&metrics.upload_bytes, uploaded * sizeof(Vertex));
+	gauge_set(&metrics.gpu_buffer_bytes, buffer_size * sizeof(Vertex));
+
+	return total_mesh_size;
+}
+
+// Re-uploads the meshes of chunks[indices[0..count)] in place, falling back to
+// upload_world() once one has outgrown its room. Returns the bytes uploaded.
+u64 upload_chunks(World *world, u32 *indices, u32 count, glm::vec3 cam_pos) {
+	for (u32 i = 0; i < count; i++) {
+		if (world->on_gpu[indices[i]] && world->chunks[indices[i]]->mesh_size > world->draw_capacity[indices[i]]) {
+			return upload_world(world, cam_pos) * sizeof(Vertex);
+		}
+	}
+
+	ScopedTimer timer(&metrics.upload_time);
+
+	u64 bytes = 0;
+	for (u32 i = 0; i < count; i++) {
+		Chunk *chunk = world->chunks[indices[i]];
+		if (world->on_gpu[indices[i]] && chunk->mesh_size > 0) {
+			glBufferSubData(GL_ARRAY_BUFFER, world->draw_first[indices[i]] * sizeof(Vertex), chunk->mesh_size * sizeof(Vertex), chunk->mesh);
+			bytes += chunk->mesh_size * sizeof(Vertex);
+		}
+	}
+
+	counter_add(&metrics.uploads, 1);
+	counter_add(&metrics.upload_bytes, bytes);
+	return bytes;
+}
+
+// Grid index of the loaded slot for a section, -1 when it's outside the window
+i32 world_slot(World *world, SectionPos pos) {
+	i64 y = pos.c_y - world->y_base;
+	if (pos.c_x < 0 || pos.c_x >= NUM_X_CHUNKS || y < 0 || y >= NUM_Y_CHUNKS || pos.c_z < 0 || pos.c_z >= NUM_Z_CHUNKS) {
+		return -1;
+	}
+	return COMPRESS_THREE(pos.c_x, y, pos.c_z, NUM_X_CHUNKS, NUM_Y_CHUNKS);
+}
+
+// Takes in what the server sent since the last frame. Arrived sections replace
+// their stand-ins, deltas are applied to the sections they're for and those
+// slots are added to changed[0..*num_changed). Returns the sections that arrived,
+// each of which changes the vertex buffer's layout.
+u32 receive_sections(World *world, u32 *changed, u32 *num_changed, FrameState *frame) {
+	u32 arrived = 0;
+	*num_changed = 0;
+
+	bool open = world_client_receive(world->server, 0, [&](u32 type, u8 *payload, u32 size) {
+		if (type == MSG_SECTION) {
+			Chunk *chunk = section_decode<Chunk>(payload, size);
+			if (chunk == NULL) {
+				return;
 			}
 
-			if (column_height > CHUNK_HEIGHT) {
-				column_height = CHUNK_HEIGHT;
+			// Sections that left the window before they arrived were dropped already
+			i32 slot = world_slot(world, chunk_section_pos(chunk));
+			if (slot < 0 || !world->waiting[slot]) {
+				free_chunk(chunk);
+				return;
 			}
 
-			if (column_height < min_height) {
-				column_height = min_height;
+			free_chunk(world->chunks[slot]);
+			world->chunks[slot] = chunk;
+			world->waiting[slot] = false;
+			world->num_waiting--;
+			frame->sections_received++;
+			arrived++;
+		} else if (type == MSG_DELTA) {
+			SectionPos pos;
+			i32 slot = delta_pos(payload, size, &pos) ? world_slot(world, pos) : -1;
+			if (slot < 0 || world->waiting[slot]) {
+				return;
 			}
 
-			for (u32 h = min_height - 1; h < column_height; h++) {
-				if ((h % 2) == 0) {
-					chunk->blocks[x][h][z] = 1;
-				} else if ((h % 3) == 0) {
-					chunk->blocks[x][h][z] = 2;
-				} else {
-					chunk->blocks[x][h][z] = 3;
-				}
+			// Deltas splice the blocks and mesh the budget may have evicted
+			chunk_restore(world->chunks[slot]);
+			if (!delta_apply(world->chunks[slot], payload, size)) {
+				return;
+			}
+
+			frame->deltas_received++;
+			if (std::find(changed, changed + *num_changed, (u32)slot) == changed + *num_changed) {
+				changed[(*num_changed)++] = slot;
 			}
 		}
+	});
+
+	if (!open) {
+		printf("Lost the world server, generating sections from here on\n");
+		world_client_close(world->server);
+		free(world->server);
+		world->server = NULL;
 	}
 
-	return chunk;
+	return arrived;
 }
 
-u64 generate_mesh(Chunk **chunks) {
-	u64 total_mesh_size = 0;
-	u64 face = 0;
-	u64 blocks = 0;
-	for (u32 c_x = 1; c_x <= NUM_X_CHUNKS; ++c_x) {
-		for (u32 c_z = 1; c_z <= NUM_Z_CHUNKS; ++c_z) {
-			Chunk *chunk = chunks[COMPRESS_TWO(c_x, c_z, NUM_X_CHUNKS + 2)];
-			if (chunk != NULL) {
-				if (chunk->mesh == NULL) {
-					chunk->mesh = (Vertex *)malloc((CHUNK_WIDTH + 2) * (CHUNK_HEIGHT + 2) * (CHUNK_DEPTH + 2) * sizeof(Vertex) * 36);
+// Height of the highest solid block top in every world column of chunk column
+// c_x, c_z, which the snow lands on. Scans the sections from the top down,
+// reading evicted blocks without bringing them back.
+void build_surface_column(World *world, SurfaceMap *surface, u32 c_x, u32 c_z) {
+	ChunkCover *cover = &world->covers[COMPRESS_TWO(c_x, c_z, NUM_X_CHUNKS)];
+	ChunkColumn<Chunk> *column = &world->columns[COMPRESS_TWO(c_x, c_z, NUM_X_CHUNKS)];
+
+	f32 tops[Chunk::width][Chunk::depth];
+	for (u32 x = 0; x < Chunk::width; x++) {
+		for (u32 z = 0; z < Chunk::depth; z++) {
+			tops[x][z] = -FLT_MAX;
+		}
+	}
+
+	u32 unresolved = Chunk::width * Chunk::depth;
+	for (i32 c_y = NUM_Y_CHUNKS - 1; c_y >= 0 && unresolved > 0; c_y--) {
+		Chunk *chunk = *world_chunk(world, c_x, c_y, c_z);
+		Chunk::Slice *blocks = chunk_peek_blocks(chunk, column);
+		if (blocks == NULL && !chunk->fill) {
+			continue;
+		}
+
+		for (u32 x = 1; x <= Chunk::width; x++) {
+			for (u32 z = 1; z <= Chunk::depth; z++) {
+				if (tops[x - 1][z - 1] != -FLT_MAX) {
+					continue;
 				}
 
-				for (u32 x = 1; x <= CHUNK_WIDTH; ++x) {
-					for (u32 y = 1; y <= CHUNK_HEIGHT; ++y) {
-						for (u32 z = 1; z <= CHUNK_DEPTH; ++z) {
-							if (chunk->blocks[x][y][z] != 0) {
-								u16 air_neighbors = get_air_neighbors(chunk, x, y, z);
-
-								u64 tmp_face = face;
-								if (air_neighbors & SIDE_TOP) {
-									u16 ao_neighbors = get_air_neighbors(chunk, x, y + 1, z);
-									add_face(chunk, SIDE_TOP, x, y, z, ao_neighbors);
-									face += 1;
-								}
-								if (air_neighbors & SIDE_BOTTOM) {
-									u16 ao_neighbors = get_air_neighbors(chunk, x, y - 1, z);
-									add_face(chunk, SIDE_BOTTOM, x, y, z, ao_neighbors);
-									face += 1;
-								}
-								if (air_neighbors & SIDE_LEFT) {
-									u16 ao_neighbors = get_air_neighbors(chunk, x - 1, y, z);
-									add_face(chunk, SIDE_LEFT, x, y, z, ao_neighbors);
-									face += 1;
-								}
-								if (air_neighbors & SIDE_RIGHT) {
-									u16 ao_neighbors = get_air_neighbors(chunk, x + 1, y, z);
-									add_face(chunk, SIDE_RIGHT, x, y, z, ao_neighbors);
-									face += 1;
-								}
-								if (air_neighbors & SIDE_FRONT) {
-									u16 ao_neighbors = get_air_neighbors(chunk, x, y, z + 1);
-									add_face(chunk, SIDE_FRONT, x, y, z, ao_neighbors);
-									face += 1;
-								}
-								if (air_neighbors & SIDE_BACK) {
-									u16 ao_neighbors = get_air_neighbors(chunk, x, y, z - 1);
-									add_face(chunk, SIDE_BACK, x, y, z, ao_neighbors);
-									face += 1;
-								}
-
-								if (tmp_face != face) {
-									blocks += 1;
-								}
-							}
-						}
+				if (blocks == NULL) {
+					tops[x - 1][z - 1] = chunk->y_off + Chunk::height + 1;
+					unresolved--;
+					continue;
+				}
+
+				for (u32 y = Chunk::height; y >= 1; y--) {
+					if (blocks[x][y][z] != 0) {
+						tops[x - 1][z - 1] = chunk->y_off + y + 1;
+						unresolved--;
+						break;
 					}
 				}
 			}
-			total_mesh_size += chunk->mesh_size;
 		}
 	}
 
-	printf("blocks: %llu\n", blocks);
-	printf("faces: %llu\n", face);
-	return total_mesh_size;
+	for (u32 x = 1; x <= Chunk::width; x++) {
+		for (u32 z = 1; z <= Chunk::depth; z++) {
+			u32 world_x = c_x * Chunk::width + x - 1;
+			u32 world_z = c_z * Chunk::depth + z - 1;
+			surface->heights[COMPRESS_TWO(world_x, world_z, surface->size_x)] = tops[x - 1][z - 1];
+			cover->top[z - 1][x - 1] = tops[x - 1][z - 1];
+		}
+	}
+}
+
+void build_surface(World *world, SurfaceMap *surface) {
+	for (u32 c_x = 0; c_x < NUM_X_CHUNKS; c_x++) {
+		for (u32 c_z = 0; c_z < NUM_Z_CHUNKS; c_z++) {
+			build_surface_column(world, surface, c_x, c_z);
+		}
+	}
+}
+
+typedef struct SnowRenderer {
+	GLuint program;
+	GLuint vao;
+	GLuint buffer;
+
+	GLint u_pv;
+	GLint u_cam_right;
+	GLint u_cam_up;
+	GLint u_flake_size;
+} SnowRenderer;
+
+// Flake positions are streamed as three consecutive arrays straight from the
+// SnowField, one instance per flake
+void snow_renderer_init(SnowRenderer *renderer, SnowField *snow) {
+	renderer->program = load_and_build_program("src/snow_vert.vsh", "src/snow_frag.fsh");
+	renderer->u_pv = glGetUniformLocation(renderer->program, "pv");
+	renderer->u_cam_right = glGetUniformLocation(renderer->program, "cam_right");
+	renderer->u_cam_up = glGetUniformLocation(renderer->program, "cam_up");
+	renderer->u_flake_size = glGetUniformLocation(renderer->program, "flake_size");
+
+	glGenVertexArrays(1, &renderer->vao);
+	glBindVertexArray(renderer->vao);
+
+	glGenBuffers(1, &renderer->buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, renderer->buffer);
+	glBufferData(GL_ARRAY_BUFFER, snow->count * sizeof(f32) * 3, NULL, GL_STREAM_DRAW);
+
+	const char *names[] = { "flake_x", "flake_y", "flake_z" };
+	for (u32 i = 0; i < 3; i++) {
+		GLuint attrib = glGetAttribLocation(renderer->program, names[i]);
+		glEnableVertexAttribArray(attrib);
+		glVertexAttribPointer(attrib, 1, GL_FLOAT, GL_FALSE, sizeof(f32), (void *)(u64)(i * snow->count * sizeof(f32)));
+		glVertexAttribDivisor(attrib, 1);
+	}
+}
+
+// Returns the bytes uploaded
+u64 draw_snow(SnowRenderer *renderer, SnowField *snow, glm::mat4 pv, glm::mat4 view) {
+	u64 array_bytes = snow->count * sizeof(f32);
+
+	glUseProgram(renderer->program);
+	glBindVertexArray(renderer->vao);
+	glBindBuffer(GL_ARRAY_BUFFER, renderer->buffer);
+
+	// Orphan last frame's storage so the driver doesn't wait for it to be drawn
+	glBufferData(GL_ARRAY_BUFFER, array_bytes * 3, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, array_bytes, snow->x);
+	glBufferSubData(GL_ARRAY_BUFFER, array_bytes, array_bytes, snow->y);
+	glBufferSubData(GL_ARRAY_BUFFER, array_bytes * 2, array_bytes, snow->z);
+
+	glm::vec3 cam_right = glm::vec3(view[0][0], view[1][0], view[2][0]);
+	glm::vec3 cam_up = glm::vec3(view[0][1], view[1][1], view[2][1]);
+
+	glUniformMatrix4fv(renderer->u_pv, 1, GL_FALSE, &pv[0][0]);
+	glUniform3fv(renderer->u_cam_right, 1, &cam_right[0]);
+	glUniform3fv(renderer->u_cam_up, 1, &cam_up[0]);
+	glUniform1f(renderer->u_flake_size, SNOW_FLAKE_SIZE);
+
+	// The quads face the camera, their winding depends on which way it looks
+	glDisable(GL_CULL_FACE);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, snow->count);
+	glEnable(GL_CULL_FACE);
+
+	counter_add(&metrics.snow_upload_bytes, array_bytes * 3);
+	return array_bytes * 3;
+}
+
+typedef struct CoverRenderer {
+	GLuint program;
+	GLuint vao;
+	GLuint top_buffer;
+	GLuint snow_buffer;
+
+	GLint u_pv;
+} CoverRenderer;
+
+// Every world column is an instance, a slab as thick as its snow standing on its
+// top face. Tops and depths live in separate buffers as they change at different rates.
+void cover_renderer_init(CoverRenderer *renderer, World *world) {
+	renderer->program = load_and_build_program("src/cover_vert.vsh", "src/cover_frag.fsh");
+	renderer->u_pv = glGetUniformLocation(renderer->program, "pv");
+
+	glUseProgram(renderer->program);
+	glUniform2i(glGetUniformLocation(renderer->program, "cover_size"), ChunkCover::width, ChunkCover::depth);
+	glUniform1i(glGetUniformLocation(renderer->program, "covers_x"), NUM_X_CHUNKS);
+	glUniform2f(glGetUniformLocation(renderer->program, "origin"), world->covers[0].x, world->covers[0].z);
+	glUniform1f(glGetUniformLocation(renderer->program, "step_height"), 1.0f / SNOW_COVER_STEPS);
+
+	glGenVertexArrays(1, &renderer->vao);
+	glBindVertexArray(renderer->vao);
+
+	GLuint a_top = glGetAttribLocation(renderer->program, "top");
+	glGenBuffers(1, &renderer->top_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, renderer->top_buffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(world->covers[0].top) * ARRAY_SIZE(world->covers), NULL, GL_DYNAMIC_DRAW);
+	glEnableVertexAttribArray(a_top);
+	glVertexAttribPointer(a_top, 1, GL_FLOAT, GL_FALSE, sizeof(f32), 0);
+	glVertexAttribDivisor(a_top, 1);
+
+	GLuint a_snow = glGetAttribLocation(renderer->program, "snow");
+	glGenBuffers(1, &renderer->snow_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, renderer->snow_buffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(world->covers[0].snow) * ARRAY_SIZE(world->covers), NULL, GL_DYNAMIC_DRAW);
+	glEnableVertexAttribArray(a_snow);
+	glVertexAttribIPointer(a_snow, 1, GL_UNSIGNED_BYTE, sizeof(u8), 0);
+	glVertexAttribDivisor(a_snow, 1);
+}
+
+// After build_surface(), the ground under the snow moved
+void upload_cover_top(CoverRenderer *renderer, World *world, u32 i) {
+	glBindBuffer(GL_ARRAY_BUFFER, renderer->top_buffer);
+	glBufferSubData(GL_ARRAY_BUFFER, i * sizeof(world->covers[i].top), sizeof(world->covers[i].top), world->covers[i].top);
+}
+
+void upload_cover_tops(CoverRenderer *renderer, World *world) {
+	for (u32 i = 0; i < ARRAY_SIZE(world->covers); i++) {
+		upload_cover_top(renderer, world, i);
+	}
+}
+
+// After chunks[indices[0..count)] changed blocks, the ground the snow lands on
+// may have moved in their chunk columns
+void rebuild_surface_columns(World *world, SurfaceMap *surface, CoverRenderer *renderer, u32 *indices, u32 count) {
+	bool column_changed[NUM_X_CHUNKS * NUM_Z_CHUNKS] = {};
+	for (u32 i = 0; i < count; i++) {
+		u32 c_x = indices[i] % NUM_X_CHUNKS;
+		u32 c_z = indices[i] / (NUM_X_CHUNKS * NUM_Y_CHUNKS);
+		column_changed[COMPRESS_TWO(c_x, c_z, NUM_X_CHUNKS)] = true;
+	}
+	for (u32 i = 0; i < ARRAY_SIZE(column_changed); i++) {
+		if (column_changed[i]) {
+			build_surface_column(world, surface, i % NUM_X_CHUNKS, i / NUM_X_CHUNKS);
+			upload_cover_top(renderer, world, i);
+		}
+	}
+}
+
+// Uploads the changed rows of each cover, returns the bytes uploaded
+u64 upload_cover_snow(CoverRenderer *renderer, World *world) {
+	u64 bytes = 0;
+
+	glBindBuffer(GL_ARRAY_BUFFER, renderer->snow_buffer);
+	for (u32 i = 0; i < ARRAY_SIZE(world->covers); i++) {
+		ChunkCover *cover = &world->covers[i];
+		bytes += snow_cover_flush(cover, [=](u32 first, u32 count) {
+			glBufferSubData(GL_ARRAY_BUFFER, i * sizeof(cover->snow) + first * sizeof(cover->snow[0]), count * sizeof(cover->snow[0]), cover->snow[first]);
+		});
+	}
+
+	counter_add(&metrics.snow_cover_upload_bytes, bytes);
+	return bytes;
+}
+
+void draw_cover(CoverRenderer *renderer, World *world, glm::mat4 pv) {
+	glUseProgram(renderer->program);
+	glBindVertexArray(renderer->vao);
+	glUniformMatrix4fv(renderer->u_pv, 1, GL_FALSE, &pv[0][0]);
+
+	glDisable(GL_CULL_FACE);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 14, ChunkCover::width * ChunkCover::depth * (ARRAY_SIZE(world->covers)));
+	glEnable(GL_CULL_FACE);
+}
+
+// Budget caps are given in MiB, unset or 0 for none
+u64 budget_cap_from_env(const char *name) {
+	return getenv(name) ? strtoull(getenv(name), NULL, 10) * 1024 * 1024 : 0;
 }
 
 int main() {
+	metrics_init();
+	metrics_start_exporter(getenv("SNOW_METRICS_SOCKET"), getenv("SNOW_METRICS_FILE"), METRICS_INTERVAL_MS);
+
 	SDL_Init(SDL_INIT_VIDEO);
 
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
@@ -428,10 +766,21 @@ int main() {
 	int screen_height = 480;
 	int screen_width = 640;
 
-	SDL_Window *window = SDL_CreateWindow("Snow", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, screen_width, screen_height, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
+	SDL_Window *window = SDL_CreateWindow("Snow", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, screen_width, screen_height, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
 	SDL_GLContext gl_context = SDL_GL_CreateContext(window);
 	SDL_GL_GetDrawableSize(window, &screen_width, &screen_height);
 
+	u32 bench_frames = getenv("SNOW_BENCH_FRAMES") ? strtoul(getenv("SNOW_BENCH_FRAMES"), NULL, 10) : 0;
+	u32 bench_frame = 0;
+	u64 bench_start = 0;
+	u64 bench_worst = 0;
+	u64 bench_samples = 0;
+	u64 bench_occluded = 0;
+	if (bench_frames > 0) {
+		// Measure the renderer, not the display's refresh rate
+		SDL_GL_SetSwapInterval(0);
+	}
+
     GLuint obj_shader = load_and_build_program("src/obj_vert.vsh", "src/obj_frag.fsh");
 
 	GLuint vao = 0;
@@ -481,51 +830,103 @@ int main() {
 	glCullFace(GL_FRONT);
 	glFrontFace(GL_CW);
 
-	Chunk **chunks = (Chunk **)malloc(sizeof(Chunk *) * (NUM_X_CHUNKS + 2) * (NUM_Z_CHUNKS + 2));
-	for (u32 x = 1; x <= NUM_X_CHUNKS; x++) {
-		for (u32 z = 1; z <= NUM_Z_CHUNKS; z++) {
-			Chunk *chunk = generate_chunk(x - 1, z - 1);
-    		chunks[COMPRESS_TWO(x, z, NUM_X_CHUNKS + 2)] = chunk;
+	glm::vec3 cam_pos = glm::vec3(0.0, 50.0, 0.0);
+	glm::vec3 cam_front = glm::vec3(0.0, 0.0, 1.0);
+	glm::vec3 cam_up = glm::vec3(0.0, 1.0, 0.0);
 
-		}
+	if (getenv("SNOW_SEED") != NULL) {
+		world_seed = strtoul(getenv("SNOW_SEED"), NULL, 10);
 	}
-	for (u32 x = 0; x <= NUM_X_CHUNKS; x++) {
-		for (u32 z = 0; z <= NUM_Z_CHUNKS; z++) {
-			if (x == 0 || z == 0) {
-				chunks[COMPRESS_TWO(x, z, NUM_X_CHUNKS + 2)] = NULL;
-			}
+
+	World *world = (World *)malloc(sizeof(World));
+	world->baked_dir = getenv("SNOW_WORLD");
+	budget_init(&world->budget, ARRAY_SIZE(world->chunks), budget_cap_from_env("SNOW_BLOCK_BUDGET"), budget_cap_from_env("SNOW_MESH_BUDGET"),
+		budget_cap_from_env("SNOW_GPU_BUDGET"));
+	world->server = NULL;
+	world->viewer_sent = glm::vec3(FLT_MAX);
+
+	if (getenv("SNOW_SERVER") != NULL) {
+		world->server = (WorldClient *)malloc(sizeof(WorldClient));
+		if (world_client_connect(world->server, getenv("SNOW_SERVER"))) {
+			printf("streaming sections from %s, seed %u\n", getenv("SNOW_SERVER"), world_seed);
+		} else {
+			printf("generating sections locally instead\n");
+			free(world->server);
+			world->server = NULL;
 		}
 	}
 
-	u64 total_mesh_size = generate_mesh(chunks);
+	viewer_moved(world, cam_pos);
+	load_world(world, section_window_base(cam_pos));
 
-	glBufferData(GL_ARRAY_BUFFER, total_mesh_size * sizeof(Vertex), NULL, GL_STATIC_DRAW);
-	u64 mesh_indent = 0;
-	for (u32 x = 1; x <= NUM_X_CHUNKS; ++x) {
-		for (u32 z = 1; z <= NUM_Z_CHUNKS; ++z) {
-			Chunk *chunk = chunks[COMPRESS_TWO(x, z, NUM_X_CHUNKS + 2)];
-			u64 mesh_size = chunk->mesh_size;
-
-			glBufferSubData(GL_ARRAY_BUFFER, mesh_indent * sizeof(Vertex), mesh_size * sizeof(Vertex), chunk->mesh);
-			mesh_indent += mesh_size;
+	u32 empty_sections = 0;
+	for (u32 i = 0; i < ARRAY_SIZE(world->chunks); i++) {
+		if (world->chunks[i]->blocks == NULL) {
+			empty_sections++;
 		}
 	}
+	printf("sections: %u (%u without block data)\n", (u32)(ARRAY_SIZE(world->chunks)), empty_sections);
+	printf("blocks: %llu\n", (unsigned long long)world->stats.blocks);
+	printf("faces: %llu\n", (unsigned long long)world->stats.faces);
+
+	upload_world(world, cam_pos);
+
+	SurfaceMap surface;
+	surface.origin_x = 1;
+	surface.origin_z = 1;
+	surface.size_x = NUM_X_CHUNKS * Chunk::width;
+	surface.size_z = NUM_Z_CHUNKS * Chunk::depth;
+	surface.heights = (f32 *)malloc(sizeof(f32) * surface.size_x * surface.size_z);
+	build_surface(world, &surface);
 
+	// The main thread simulates too, so one worker fewer than cores
+	JobPool pool;
+	u32 cores = std::thread::hardware_concurrency();
+	job_pool_start(&pool, cores > 1 ? cores - 1 : 0);
+
+	u32 num_flakes = getenv("SNOW_FLAKES") ? strtoul(getenv("SNOW_FLAKES"), NULL, 10) : SNOW_DEFAULT_FLAKES;
+	SnowField snow;
+	snow_init(&snow, num_flakes, cam_pos, glm::vec3(128.0f, 96.0f, 128.0f));
+
+	SnowRenderer snow_renderer;
+	snow_renderer_init(&snow_renderer, &snow);
+
+	CoverRenderer cover_renderer;
+	cover_renderer_init(&cover_renderer, world);
+	upload_cover_tops(&cover_renderer, world);
+
+	SnowClock snow_clock;
+	bzero(&snow_clock, sizeof(SnowClock));
+	bool snowing = num_flakes > 0;
+
+	BlockTicker<Chunk> ticker;
+	block_ticker_init(&ticker, world->chunks, NUM_X_CHUNKS, NUM_Y_CHUNKS, NUM_Z_CHUNKS, &pool);
+	// A world server owns the blocks, ticking a copy of them here would drift from it
+	bool ticking = world->server == NULL;
 
 	f32 current_time = (f32)SDL_GetTicks() / 60.0;
 
 	f64 fps_last_tick = (f64)SDL_GetTicks() / 1000.0;
-	u64 frames = 0;
 
-	glm::vec3 cam_pos = glm::vec3(0.0, 50.0, 0.0);
-	glm::vec3 cam_front = glm::vec3(0.0, 0.0, 1.0);
-	glm::vec3 cam_up = glm::vec3(0.0, 1.0, 0.0);
+	WorldDraw draws;
+	world_draw_init(&draws, ARRAY_SIZE(world->chunks), world->chunks, world->draw_first, world->on_gpu);
+
+	OcclusionCuller culler;
+	occlusion_init(&culler, ARRAY_SIZE(world->chunks));
+	bool occluding = getenv("SNOW_OCCLUSION") == NULL || strtoul(getenv("SNOW_OCCLUSION"), NULL, 10) != 0;
+
+	FrameState frame;
+	bzero(&frame, sizeof(FrameState));
+	frame.idle_mode = bench_frames == 0;
+	frame.world_dirty = true;
+	frame.animating = snowing;
 
 	f32 yaw = 0.0f;
 	f32 pitch = 0.0f;
 	f32 cam_speed = 0.75f;
 
 	KeyHandler keyboard;
+	bzero(&keyboard, sizeof(KeyHandler));
 
 	bool running = true;
 	bool warped = false;
@@ -533,17 +934,97 @@ int main() {
 	while (running) {
 		SDL_Event event;
 
+		// Nothing changed since the last swap, so sleep until input arrives instead of redrawing
+		if (!frame_needs_redraw(&frame, cam_pos, cam_front)) {
+			SDL_WaitEventTimeout(NULL, world->server && world->num_waiting > 0 ? std::min(SERVER_WAIT_MS, (i32)frame_idle_wait_ms(&frame)) : frame_idle_wait_ms(&frame));
+		}
+
+		// Time spent blocked above is clamped instead of thrown away, so the first
+		// frame after a key goes down still moves the camera
 		f32 new_time = (f32)SDL_GetTicks() / 60.0;
-		f32 dt = new_time - current_time;
+		f32 dt = std::min(new_time - current_time, MAX_FRAME_MS / 60.0f);
 		current_time = new_time;
 
 		f64 fps_curr_tick = (f64)SDL_GetTicks() / 1000.0;
-		frames++;
 
 		if (fps_curr_tick - fps_last_tick >= 1.0) {
-			printf("%f ms/frame\n", 1000.0/(f32)frames);
-			frames = 0;
-			fps_last_tick += 1.0;
+			if (frame.frames_drawn > 0) {
+				printf("%f ms/frame, %llu frames drawn, %llu skipped, %llu buckets and %llu/%llu vertices culled per frame\n", frame.frame_ns / 1e6 / frame.frames_drawn,
+					(unsigned long long)frame.frames_drawn, (unsigned long long)frame.frames_skipped,
+					(unsigned long long)(frame.draw.buckets_skipped / frame.frames_drawn), (unsigned long long)(frame.draw.vertices_culled / frame.frames_drawn),
+					(unsigned long long)((frame.draw.vertices_drawn + frame.draw.vertices_culled) / frame.frames_drawn));
+
+				f64 samples = (culler.samples_drawn - frame.samples_seen) / (f64)frame.frames_drawn;
+				printf("occlusion culling %s: %.0fk pixels drawn, %.1f of %.1f hidden chunks and %llu vertices skipped per frame", occluding ? "on" : "off", samples / 1000.0,
+					(f64)(culler.chunks_skipped - frame.skipped_seen) / frame.frames_drawn, (f64)(culler.chunks_hidden - frame.hidden_seen) / frame.frames_drawn,
+					(unsigned long long)((culler.vertices_skipped - frame.vertices_skipped_seen) / frame.frames_drawn));
+				if (occluding && frame.unculled_samples > 0) {
+					printf(", %.0f%% fewer pixels than with it off", 100.0 * (1.0 - samples / frame.unculled_samples));
+				} else if (!occluding) {
+					frame.unculled_samples = samples;
+				}
+				printf("\n");
+			} else {
+				printf("idle, %llu frames skipped (%llu total)\n", (unsigned long long)frame.frames_skipped, (unsigned long long)frame.total_frames_skipped);
+			}
+			// Flakes only move on frames that were drawn, so frames_drawn > 0 here
+			if (frame.snow_flakes > 0) {
+				printf("snow: %u flakes, %.2f ns/flake, %.1f KiB uploaded per frame\n", snow.count, (f64)frame.snow_ns / frame.snow_flakes,
+					frame.snow_upload_bytes / 1024.0 / frame.frames_drawn);
+			}
+			frame.frames_drawn = 0;
+			frame.frame_ns = 0;
+			frame.samples_seen = culler.samples_drawn;
+			frame.hidden_seen = culler.chunks_hidden;
+			frame.skipped_seen = culler.chunks_skipped;
+			frame.vertices_skipped_seen = culler.vertices_skipped;
+			frame.frames_skipped = 0;
+			bzero(&frame.draw, sizeof(DrawStats));
+			if (frame.cover_ticks > 0) {
+				printf("snow cover: %llu ticks, %.1f us/tick, %.1f KiB uploaded\n", (unsigned long long)frame.cover_ticks, frame.cover_ns / 1000.0 / frame.cover_ticks,
+					frame.cover_upload_bytes / 1024.0);
+			}
+			frame.snow_ns = 0;
+			frame.snow_flakes = 0;
+			frame.snow_upload_bytes = 0;
+			frame.cover_ns = 0;
+			frame.cover_ticks = 0;
+			if (frame.ticks_run > 0) {
+				printf("block ticks: %llu ticks, %.1f us/tick, %.2f us/chunk, %llu blocks changed, %llu chunks remeshed, %.1f KiB uploaded\n",
+					(unsigned long long)frame.ticks_run, frame.tick_ns / 1000.0 / frame.ticks_run, frame.chunks_ticked ? frame.tick_chunk_ns / 1000.0 / frame.chunks_ticked : 0.0,
+					(unsigned long long)frame.blocks_changed, (unsigned long long)frame.chunks_remeshed, frame.mesh_upload_bytes / 1024.0);
+			}
+			frame.cover_upload_bytes = 0;
+			frame.tick_ns = 0;
+			frame.tick_chunk_ns = 0;
+			frame.ticks_run = 0;
+			frame.chunks_ticked = 0;
+			frame.blocks_changed = 0;
+			if (frame.sections_received > 0 || frame.deltas_received > 0) {
+				printf("world server: %llu sections and %llu deltas received, %u still due\n", (unsigned long long)frame.sections_received,
+					(unsigned long long)frame.deltas_received, world->num_waiting);
+			}
+			frame.chunks_remeshed = 0;
+			frame.mesh_upload_bytes = 0;
+			frame.sections_received = 0;
+			frame.deltas_received = 0;
+
+			MemoryBudget *budget = &world->budget;
+			if (budget->tiers[TIER_BLOCKS].cap || budget->tiers[TIER_MESHES].cap || budget->tiers[TIER_GPU].cap) {
+				printf("memory:");
+				for (u32 t = 0; t < BUDGET_TIERS; t++) {
+					BudgetTier *tier = &budget->tiers[t];
+					printf(" %s %.1f/%.1f MiB, %llu evicted/s%s", budget_tier_names[t], tier->used / (1024.0 * 1024.0), tier->cap / (1024.0 * 1024.0),
+						(unsigned long long)(tier->evictions - frame.evictions_seen[t]), t + 1 < BUDGET_TIERS ? ";" : "");
+					frame.evictions_seen[t] = tier->evictions;
+				}
+				u64 restores = metrics.blocks_restored.value;
+				printf(" (%.1f MiB packed, %llu restored/s, %llu just changed evicted/s, %u sections not drawn)\n", budget->packed_bytes / (1024.0 * 1024.0),
+					(unsigned long long)(restores - frame.restores_seen), (unsigned long long)(budget->kept_evictions - frame.kept_evictions_seen), budget->gpu_left_out);
+				frame.restores_seen = restores;
+				frame.kept_evictions_seen = budget->kept_evictions;
+			}
+			fps_last_tick = fps_curr_tick;
 		}
 
 		const u8 *state = SDL_GetKeyboardState(NULL);
@@ -568,6 +1049,38 @@ int main() {
 							warp = false;
 							SDL_SetRelativeMouseMode(SDL_FALSE);
 						} break;
+						case SDLK_i: {
+							frame.idle_mode = !frame.idle_mode;
+							printf("idle mode: %s\n", frame.idle_mode ? "on" : "off");
+						} break;
+						case SDLK_n: {
+							snowing = !snowing && snow.count > 0;
+							frame.animating = snowing;
+							frame.world_dirty = true;
+							printf("snow: %s\n", snowing ? "on" : "off");
+						} break;
+						case SDLK_t: {
+							ticking = !ticking;
+							printf("block ticks: %s\n", ticking ? "on" : "off");
+						} break;
+						case SDLK_o: {
+							occluding = !occluding;
+							frame.world_dirty = true;
+							printf("occlusion culling: %s\n", occluding ? "on" : "off");
+						} break;
+					}
+				} break;
+				case SDL_WINDOWEVENT: {
+					switch (event.window.event) {
+						case SDL_WINDOWEVENT_SIZE_CHANGED: {
+							SDL_GL_GetDrawableSize(window, &screen_width, &screen_height);
+							glViewport(0, 0, screen_width, screen_height);
+							frame.window_dirty = true;
+						} break;
+						case SDL_WINDOWEVENT_EXPOSED:
+						case SDL_WINDOWEVENT_RESTORED: {
+							frame.window_dirty = true;
+						} break;
 					}
 				} break;
 				case SDL_MOUSEMOTION: {
@@ -626,6 +1139,83 @@ int main() {
 		}
 		bzero(&keyboard, sizeof(KeyHandler));
 
+		if (bench_frames > 0) {
+			if (bench_frame == 0) {
+				bench_start = metrics_now_ns();
+				bench_samples = metrics.world_samples.value;
+				bench_occluded = metrics.chunks_occluded.value;
+			}
+			bench_camera(bench_frame, VIEW_WIDTH, &cam_pos, &cam_front);
+		}
+
+		viewer_moved(world, cam_pos);
+		if (stream_world(world, section_window_base(cam_pos))) {
+			glBindBuffer(GL_ARRAY_BUFFER, v_mesh);
+			upload_world(world, cam_pos);
+			occlusion_reset(&culler);
+			build_surface(world, &surface);
+			upload_cover_tops(&cover_renderer, world);
+			frame.world_dirty = true;
+		}
+
+		if (world->server != NULL) {
+			u32 changed[ARRAY_SIZE(world->chunks)];
+			u32 num_changed = 0;
+			u32 arrived = receive_sections(world, changed, &num_changed, &frame);
+			gauge_set(&metrics.sections_waiting, world->num_waiting);
+
+			glBindBuffer(GL_ARRAY_BUFFER, v_mesh);
+			if (arrived > 0) {
+				upload_world(world, cam_pos);
+				build_surface(world, &surface);
+				upload_cover_tops(&cover_renderer, world);
+				frame.world_dirty = true;
+			} else if (num_changed > 0) {
+				frame.mesh_upload_bytes += upload_chunks(world, changed, num_changed, cam_pos);
+				rebuild_surface_columns(world, &surface, &cover_renderer, changed, num_changed);
+				frame.world_dirty = true;
+			}
+		}
+
+		// dt counts 60ms ticks, the simulations want seconds
+		f32 seconds = dt * 60.0f / 1000.0f;
+		f32 snow_dt = std::min(seconds, 0.1f);
+
+		if (ticking) {
+			frame.tick_ns += block_ticker_update(&ticker, seconds);
+			frame.tick_chunk_ns += ticker.chunk_ns;
+			frame.ticks_run += ticker.ticks_run;
+			frame.chunks_ticked += ticker.chunks_ticked;
+			frame.blocks_changed += ticker.blocks_changed;
+
+			if (ticker.num_remesh > 0) {
+				block_ticker_remesh(&ticker);
+				glBindBuffer(GL_ARRAY_BUFFER, v_mesh);
+				frame.mesh_upload_bytes += upload_chunks(world, ticker.remesh, ticker.num_remesh, cam_pos);
+				frame.chunks_remeshed += ticker.num_remesh;
+
+				// Melting and falling blocks move the ground the snow lands on
+				rebuild_surface_columns(world, &surface, &cover_renderer, ticker.remesh, ticker.num_remesh);
+				frame.world_dirty = true;
+			}
+		}
+
+		// Sections just loaded, received or remeshed may have taken memory over a cap
+		if (budget_enforce(&world->budget, world->chunks, world->on_gpu, ticker.remesh, ticking ? ticker.num_remesh : 0, cam_pos)) {
+			glBindBuffer(GL_ARRAY_BUFFER, v_mesh);
+			upload_world(world, cam_pos);
+			frame.world_dirty = true;
+		}
+
+		if (!frame_needs_redraw(&frame, cam_pos, cam_front)) {
+			frame.frames_skipped++;
+			frame.total_frames_skipped++;
+			counter_add(&metrics.frames_skipped, 1);
+			continue;
+		}
+
+		u64 frame_start = metrics_now_ns();
+
 		glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 		glUseProgram(obj_shader);
 
@@ -642,11 +1232,59 @@ int main() {
 		glUniformMatrix4fv(u_pv, 1, GL_FALSE, &pv[0][0]);
 		glUniformMatrix4fv(u_model, 1, GL_FALSE, &model[0][0]);
 
-		glDrawArrays(GL_TRIANGLES, 0, total_mesh_size * sizeof(Vertex));
+		draw_world(&draws, &culler, occluding, obj_shader, vao, pv, cam_pos, &frame.draw);
+
+		if (snowing) {
+			frame.cover_ns += snow_cover_update(world->covers, ARRAY_SIZE(world->covers), &snow_clock, snow_dt);
+			frame.cover_ticks += snow_clock.ticks;
+			frame.cover_upload_bytes += upload_cover_snow(&cover_renderer, world);
+		}
+		draw_cover(&cover_renderer, world, pv);
+
+		if (snowing) {
+			frame.snow_ns += snow_simulate(&snow, &surface, &pool, cam_pos, snow_dt);
+			frame.snow_flakes += snow.count;
+			frame.snow_upload_bytes += draw_snow(&snow_renderer, &snow, pv, view);
+		}
 
 		SDL_GL_SwapWindow(window);
+		frame_presented(&frame, cam_pos, cam_front);
+
+		u64 frame_ns = metrics_now_ns() - frame_start;
+		frame.frame_ns += frame_ns;
+		counter_add(&metrics.frames, 1);
+		histogram_observe(&metrics.frame_time, frame_ns);
+
+		if (bench_frames > 0) {
+			if (frame_ns > bench_worst) {
+				bench_worst = frame_ns;
+			}
+
+			if (++bench_frame == bench_frames) {
+				f64 seconds = (metrics_now_ns() - bench_start) / 1e9;
+				printf("bench: %u frames in %.2fs, %.3f ms/frame avg, %.3f ms worst\n", bench_frames, seconds, seconds * 1000.0 / bench_frames, bench_worst / 1e6);
+				printf("bench: occlusion culling %s, %.0fk pixels drawn and %.1f chunks skipped per frame\n", occluding ? "on" : "off",
+					(metrics.world_samples.value - bench_samples) / 1000.0 / bench_frames, (f64)(metrics.chunks_occluded.value - bench_occluded) / bench_frames);
+				running = false;
+			}
+		}
 	}
 
+	if (world->server != NULL) {
+		world_client_close(world->server);
+		free(world->server);
+	}
+
+	block_ticker_free(&ticker);
+	budget_free(&world->budget);
+	occlusion_free(&culler);
+	world_draw_free(&draws);
+	job_pool_stop(&pool);
+	snow_free(&snow);
+	free(surface.heights);
+
+	metrics_stop_exporter();
+
 	SDL_GL_DeleteContext(gl_context);
 	SDL_Quit();
 	return 0;
@@ -0,0 +1,377 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cassert>
+
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "common.h"
+
+// Lock-free metrics, updated with relaxed atomics. Each one sits on its own cache
+// line, so pregen workers, job pool threads and the server updating different
+// metrics at once don't contend; threads updating the same one still share its
+// line. An exporter thread renders them as Prometheus text to a Unix socket
+// and/or a periodically rewritten file.
+
+#define MAX_METRICS 64
+#define HISTOGRAM_BUCKETS 24
+#define CACHE_LINE 64
+
+typedef struct alignas(CACHE_LINE) Counter {
+	std::atomic<u64> value;
+} Counter;
+
+typedef struct alignas(CACHE_LINE) Gauge {
+	std::atomic<i64> value;
+} Gauge;
+
+// Bucket i counts observations <= 1024 << i nanoseconds (~1us to ~8.6s), the last one is +Inf
+typedef struct alignas(CACHE_LINE) Histogram {
+	std::atomic<u64> buckets[HISTOGRAM_BUCKETS];
+	std::atomic<u64> sum;
+} Histogram;
+
+enum {
+	METRIC_COUNTER,
+	METRIC_GAUGE,
+	METRIC_HISTOGRAM,
+};
+
+typedef struct Metric {
+	const char *name;
+	const char *help;
+	u32 type;
+	void *value;
+} Metric;
+
+typedef struct Metrics {
+	Counter frames;
+	Counter frames_skipped;
+	Histogram frame_time;
+	Counter buckets_skipped;
+	Counter vertices_submitted;
+
+	Counter chunks_generated;
+	Histogram generate_time;
+	Counter meshes_generated;
+	Histogram mesh_time;
+	Counter faces_meshed;
+
+	Gauge chunks_resident;
+	Gauge chunks_with_blocks;
+	Gauge block_bytes;
+	Gauge mesh_bytes;
+	Gauge gpu_buffer_bytes;
+	Gauge packed_block_bytes;
+
+	Gauge sections_waiting;
+
+	Counter uploads;
+	Counter upload_bytes;
+	Histogram upload_time;
+
+	Counter allocations;
+	Counter frees;
+
+	Counter snow_flakes_simulated;
+	Histogram snow_sim_time;
+	Counter snow_upload_bytes;
+
+	Counter snow_cover_ticks;
+	Counter snow_cover_changes;
+	Histogram snow_cover_time;
+	Counter snow_cover_upload_bytes;
+
+	Counter block_ticks;
+	Histogram block_tick_time;
+	Histogram block_tick_chunk_time;
+	Counter blocks_changed;
+	Counter remesh_requests;
+	Gauge scheduled_ticks;
+
+	Gauge server_clients;
+	Gauge server_pending;
+	Counter server_sections_sent;
+	Counter server_sections_evicted;
+	Counter server_deltas_sent;
+	Counter server_edits;
+	Counter server_bytes_sent;
+	Counter server_raw_bytes;
+	Histogram server_request_time;
+
+	Counter meshes_dropped;
+	Counter blocks_packed;
+	Counter blocks_discarded;
+	Counter blocks_restored;
+	Histogram restore_time;
+	Counter gpu_evictions;
+	Counter kept_evictions;
+
+	Counter world_samples;
+	Counter chunks_occluded;
+} Metrics;
+
+Metrics metrics;
+
+Metric metric_registry[MAX_METRICS];
+u32 metric_count = 0;
+
+std::atomic<bool> metrics_exporter_running(false);
+std::thread metrics_exporter;
+
+inline void counter_add(Counter *counter, u64 n) {
+	counter->value.fetch_add(n, std::memory_order_relaxed);
+}
+
+inline void gauge_set(Gauge *gauge, i64 v) {
+	gauge->value.store(v, std::memory_order_relaxed);
+}
+
+inline void gauge_add(Gauge *gauge, i64 n) {
+	gauge->value.fetch_add(n, std::memory_order_relaxed);
+}
+
+inline void histogram_observe(Histogram *histogram, u64 ns) {
+	u32 bucket = 0;
+	if (ns > 1024) {
+		bucket = 64 - __builtin_clzll((ns - 1) >> 10);
+		if (bucket >= HISTOGRAM_BUCKETS) {
+			bucket = HISTOGRAM_BUCKETS - 1;
+		}
+	}
+
+	histogram->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	histogram->sum.fetch_add(ns, std::memory_order_relaxed);
+}
+
+inline u64 metrics_now_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void metric_register(const char *name, const char *help, u32 type, void *value) {
+	assert(metric_count < MAX_METRICS);
+
+	Metric *metric = &metric_registry[metric_count++];
+	metric->name = name;
+	metric->help = help;
+	metric->type = type;
+	metric->value = value;
+}
+
+void metrics_init() {
+	metric_register("snow_frames_total", "Frames presented", METRIC_COUNTER, &metrics.frames);
+	metric_register("snow_frames_skipped_total", "Loop iterations that skipped rendering in idle mode", METRIC_COUNTER, &metrics.frames_skipped);
+	metric_register("snow_frame_seconds", "Time to render and present a frame", METRIC_HISTOGRAM, &metrics.frame_time);
+	metric_register("snow_buckets_skipped_total", "Chunk face direction buckets culled for facing away from the camera", METRIC_COUNTER, &metrics.buckets_skipped);
+	metric_register("snow_vertices_submitted_total", "Vertices submitted to the GPU", METRIC_COUNTER, &metrics.vertices_submitted);
+
+	metric_register("snow_chunks_generated_total", "Chunk sections generated", METRIC_COUNTER, &metrics.chunks_generated);
+	metric_register("snow_generate_seconds", "Time to generate one chunk section", METRIC_HISTOGRAM, &metrics.generate_time);
+	metric_register("snow_meshes_generated_total", "Chunk meshes built", METRIC_COUNTER, &metrics.meshes_generated);
+	metric_register("snow_mesh_seconds", "Time to mesh one chunk section", METRIC_HISTOGRAM, &metrics.mesh_time);
+	metric_register("snow_faces_meshed_total", "Faces emitted by the mesher", METRIC_COUNTER, &metrics.faces_meshed);
+
+	metric_register("snow_chunks_resident", "Chunk sections in memory", METRIC_GAUGE, &metrics.chunks_resident);
+	metric_register("snow_chunks_with_blocks", "Chunk sections holding a block array", METRIC_GAUGE, &metrics.chunks_with_blocks);
+	metric_register("snow_block_bytes", "Bytes of chunk block data", METRIC_GAUGE, &metrics.block_bytes);
+	metric_register("snow_mesh_bytes", "Bytes of CPU side chunk meshes", METRIC_GAUGE, &metrics.mesh_bytes);
+	metric_register("snow_gpu_buffer_bytes", "Bytes of vertex data in GPU buffers", METRIC_GAUGE, &metrics.gpu_buffer_bytes);
+	metric_register("snow_packed_block_bytes", "Bytes of block data run length encoded by the memory budget", METRIC_GAUGE, &metrics.packed_block_bytes);
+
+	metric_register("snow_sections_waiting", "Sections requested from a world server that haven't arrived yet", METRIC_GAUGE, &metrics.sections_waiting);
+
+	metric_register("snow_uploads_total", "Vertex buffer uploads", METRIC_COUNTER, &metrics.uploads);
+	metric_register("snow_upload_bytes_total", "Bytes uploaded to vertex buffers", METRIC_COUNTER, &metrics.upload_bytes);
+	metric_register("snow_upload_seconds", "Time to upload the world's vertex buffer", METRIC_HISTOGRAM, &metrics.upload_time);
+
+	metric_register("snow_allocations_total", "Chunk and mesh allocations", METRIC_COUNTER, &metrics.allocations);
+	metric_register("snow_frees_total", "Chunk and mesh frees", METRIC_COUNTER, &metrics.frees);
+
+	metric_register("snow_flakes_simulated_total", "Snowflake simulation steps", METRIC_COUNTER, &metrics.snow_flakes_simulated);
+	metric_register("snow_flake_sim_seconds", "Time to advance every snowflake by one frame", METRIC_HISTOGRAM, &metrics.snow_sim_time);
+	metric_register("snow_flake_upload_bytes_total", "Snowflake positions uploaded to the GPU", METRIC_COUNTER, &metrics.snow_upload_bytes);
+
+	metric_register("snow_cover_ticks_total", "Snow cover precipitation ticks", METRIC_COUNTER, &metrics.snow_cover_ticks);
+	metric_register("snow_cover_changes_total", "Columns whose snow depth changed", METRIC_COUNTER, &metrics.snow_cover_changes);
+	metric_register("snow_cover_tick_seconds", "Time to run one snow cover tick over the loaded world", METRIC_HISTOGRAM, &metrics.snow_cover_time);
+	metric_register("snow_cover_upload_bytes_total", "Snow depths uploaded to the GPU", METRIC_COUNTER, &metrics.snow_cover_upload_bytes);
+
+	metric_register("snow_block_ticks_total", "Block ticks run over the loaded world", METRIC_COUNTER, &metrics.block_ticks);
+	metric_register("snow_block_tick_seconds", "Time to run one block tick over the loaded world", METRIC_HISTOGRAM, &metrics.block_tick_time);
+	metric_register("snow_block_tick_chunk_seconds", "Time to tick one chunk", METRIC_HISTOGRAM, &metrics.block_tick_chunk_time);
+	metric_register("snow_blocks_changed_total", "Blocks changed by block ticks", METRIC_COUNTER, &metrics.blocks_changed);
+	metric_register("snow_remesh_requests_total", "Chunks queued for remeshing by block ticks", METRIC_COUNTER, &metrics.remesh_requests);
+	metric_register("snow_scheduled_ticks", "Scheduled block ticks waiting to run", METRIC_GAUGE, &metrics.scheduled_ticks);
+
+	metric_register("snow_server_clients", "Viewers connected to the world server", METRIC_GAUGE, &metrics.server_clients);
+	metric_register("snow_server_pending_sections", "Sections requested by viewers and not yet sent", METRIC_GAUGE, &metrics.server_pending);
+	metric_register("snow_server_sections_sent_total", "Whole sections sent to viewers", METRIC_COUNTER, &metrics.server_sections_sent);
+	metric_register("snow_server_sections_evicted_total", "Sections no viewer held freed by the server to stay under its cap", METRIC_COUNTER, &metrics.server_sections_evicted);
+	metric_register("snow_server_deltas_sent_total", "Section deltas sent to viewers after edits", METRIC_COUNTER, &metrics.server_deltas_sent);
+	metric_register("snow_server_edits_total", "Block edits applied by the world server", METRIC_COUNTER, &metrics.server_edits);
+	metric_register("snow_server_sent_bytes_total", "Bytes written to viewer sockets", METRIC_COUNTER, &metrics.server_bytes_sent);
+	metric_register("snow_server_raw_bytes_total", "In-memory size of the sections sent, as whole sections", METRIC_COUNTER, &metrics.server_raw_bytes);
+	metric_register("snow_server_request_seconds", "Time from a section request arriving to the section being queued for sending", METRIC_HISTOGRAM, &metrics.server_request_time);
+
+	metric_register("snow_budget_meshes_dropped_total", "CPU side meshes freed by the memory budget", METRIC_COUNTER, &metrics.meshes_dropped);
+	metric_register("snow_budget_blocks_packed_total", "Block arrays run length encoded by the memory budget", METRIC_COUNTER, &metrics.blocks_packed);
+	metric_register("snow_budget_blocks_discarded_total", "Packed block data dropped by the memory budget to be generated again", METRIC_COUNTER, &metrics.blocks_discarded);
+	metric_register("snow_budget_blocks_restored_total", "Evicted block data brought back because it was needed", METRIC_COUNTER, &metrics.blocks_restored);
+	metric_register("snow_budget_restore_seconds", "Time to bring back one section's evicted block data", METRIC_HISTOGRAM, &metrics.restore_time);
+	metric_register("snow_budget_gpu_evictions_total", "Sections left out of the vertex buffer by the GPU budget", METRIC_COUNTER, &metrics.gpu_evictions);
+	metric_register("snow_budget_kept_evictions_total", "Evictions of sections the last block tick changed, which are evicted last", METRIC_COUNTER, &metrics.kept_evictions);
+
+	metric_register("snow_world_samples_total", "Samples of chunk meshes passing the depth test", METRIC_COUNTER, &metrics.world_samples);
+	metric_register("snow_chunks_occluded_total", "Chunk draws skipped because their bounding box was hidden", METRIC_COUNTER, &metrics.chunks_occluded);
+}
+
+void metrics_write(FILE *out) {
+	for (u32 i = 0; i < metric_count; i++) {
+		Metric *metric = &metric_registry[i];
+		fprintf(out, "# HELP %s %s\n", metric->name, metric->help);
+
+		switch (metric->type) {
+			case METRIC_COUNTER: {
+				Counter *counter = (Counter *)metric->value;
+				fprintf(out, "# TYPE %s counter\n", metric->name);
+				fprintf(out, "%s %llu\n", metric->name, (unsigned long long)counter->value.load(std::memory_order_relaxed));
+			} break;
+			case METRIC_GAUGE: {
+				Gauge *gauge = (Gauge *)metric->value;
+				fprintf(out, "# TYPE %s gauge\n", metric->name);
+				fprintf(out, "%s %lld\n", metric->name, (long long)gauge->value.load(std::memory_order_relaxed));
+			} break;
+			case METRIC_HISTOGRAM: {
+				Histogram *histogram = (Histogram *)metric->value;
+				fprintf(out, "# TYPE %s histogram\n", metric->name);
+
+				u64 cumulative = 0;
+				for (u32 b = 0; b < HISTOGRAM_BUCKETS - 1; b++) {
+					cumulative += histogram->buckets[b].load(std::memory_order_relaxed);
+					fprintf(out, "%s_bucket{le=\"%.9f\"} %llu\n", metric->name, (f64)(1024ull << b) / 1e9, (unsigned long long)cumulative);
+				}
+				cumulative += histogram->buckets[HISTOGRAM_BUCKETS - 1].load(std::memory_order_relaxed);
+
+				fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", metric->name, (unsigned long long)cumulative);
+				fprintf(out, "%s_sum %.9f\n", metric->name, (f64)histogram->sum.load(std::memory_order_relaxed) / 1e9);
+				fprintf(out, "%s_count %llu\n", metric->name, (unsigned long long)cumulative);
+			} break;
+		}
+	}
+}
+
+bool metrics_write_file(const char *path) {
+	char tmp_path[1024];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	FILE *out = fopen(tmp_path, "w");
+	if (out == NULL) {
+		printf("Couldn't write metrics to %s!\n", tmp_path);
+		return false;
+	}
+
+	metrics_write(out);
+	fclose(out);
+
+	// Scrapers never see a half written file
+	return rename(tmp_path, path) == 0;
+}
+
+i32 metrics_listen(const char *socket_path) {
+	i32 fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		printf("Couldn't create metrics socket!\n");
+		return -1;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+	unlink(socket_path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+		printf("Couldn't listen on metrics socket %s!\n", socket_path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// Serves the text format to each connection on socket_path and rewrites file_path
+// every interval_ms. Either path may be NULL.
+void metrics_start_exporter(const char *socket_path, const char *file_path, u32 interval_ms) {
+	if (socket_path == NULL && file_path == NULL) {
+		return;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	i32 listen_fd = socket_path ? metrics_listen(socket_path) : -1;
+
+	metrics_exporter_running = true;
+	metrics_exporter = std::thread([=]() {
+		u64 next_write = 0;
+		while (metrics_exporter_running) {
+			if (file_path != NULL && metrics_now_ns() >= next_write) {
+				metrics_write_file(file_path);
+				next_write = metrics_now_ns() + (u64)interval_ms * 1000000;
+			}
+
+			if (listen_fd < 0) {
+				usleep(interval_ms * 1000);
+				continue;
+			}
+
+			struct pollfd pfd;
+			pfd.fd = listen_fd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, interval_ms) > 0) {
+				i32 client = accept(listen_fd, NULL, NULL);
+				if (client >= 0) {
+					FILE *out = fdopen(client, "w");
+					if (out != NULL) {
+						metrics_write(out);
+						fclose(out);
+					} else {
+						close(client);
+					}
+				}
+			}
+		}
+
+		if (listen_fd >= 0) {
+			close(listen_fd);
+			unlink(socket_path);
+		}
+	});
+}
+
+void metrics_stop_exporter() {
+	if (metrics_exporter_running) {
+		metrics_exporter_running = false;
+		metrics_exporter.join();
+	}
+}
+
+// Records the time since start into a histogram when it goes out of scope
+typedef struct ScopedTimer {
+	Histogram *histogram;
+	u64 start;
+
+	ScopedTimer(Histogram *h) : histogram(h), start(metrics_now_ns()) {}
+	~ScopedTimer() {
+		histogram_observe(histogram, metrics_now_ns() - start);
+	}
+} ScopedTimer;
+
+#endif
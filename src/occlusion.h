@@ -0,0 +1,246 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "gl_helper.h"
+#include "metrics.h"
+
+// Hardware occlusion culling for chunks drawn front to back. Every frame, once
+// the chunks believed visible are drawn, each chunk's bounding box is drawn with
+// colour and depth writes off inside an occlusion query. A chunk whose box
+// showed no samples for a few frames in a row counts as hidden: it's drawn
+// after the boxes under conditional rendering on this frame's query, so it
+// still appears the frame it comes into view, and stops acting as an occluder
+// for the others. Results are read a frame later, never waiting on the GPU.
+
+// Frames in a row a box has to be hidden before its chunk is, so chunks on the
+// edge of a ridge don't swap passes every frame
+#define OCCLUSION_HIDE_FRAMES 3
+
+// Boxes are grown by this much so they stay in front of their own chunk's faces
+#define OCCLUSION_MARGIN 0.5f
+
+// Closer than this to a box the near plane may clip it, so it counts as visible
+#define OCCLUSION_NEAR 1.0f
+
+// The world's pixels are counted in two queries, the visible pass and the
+// conditional one, so box draws aren't counted
+enum {
+	SAMPLES_VISIBLE,
+	SAMPLES_HIDDEN,
+	SAMPLE_PASSES,
+};
+
+typedef struct OcclusionCuller {
+	GLuint program;
+	GLuint vao;
+	GLint u_pv;
+	GLint u_box_min;
+	GLint u_box_max;
+
+	u32 count;
+	GLuint *queries;
+
+	// A query went out whose result hasn't been read yet
+	bool *pending;
+	// The chunk was drawn on that query's result, with this many vertices
+	bool *conditional;
+	u32 *conditional_vertices;
+	// Frames in a row its box showed no samples
+	u8 *hidden_frames;
+
+	GLuint samples_queries[SAMPLE_PASSES];
+	bool samples_pending[SAMPLE_PASSES];
+
+	// Totals from the results read so far
+	u64 chunks_tested;
+	u64 chunks_hidden;
+	u64 chunks_skipped;
+	u64 vertices_skipped;
+	u64 samples_drawn;
+} OcclusionCuller;
+
+void occlusion_init(OcclusionCuller *culler, u32 count) {
+	culler->program = load_and_build_program("src/box_vert.vsh", "src/box_frag.fsh");
+	culler->u_pv = glGetUniformLocation(culler->program, "pv");
+	culler->u_box_min = glGetUniformLocation(culler->program, "box_min");
+	culler->u_box_max = glGetUniformLocation(culler->program, "box_max");
+
+	// The box comes from gl_VertexID, there are no attributes
+	glGenVertexArrays(1, &culler->vao);
+
+	culler->count = count;
+	culler->queries = (GLuint *)malloc(sizeof(GLuint) * count);
+	culler->pending = (bool *)calloc(count, sizeof(bool));
+	culler->conditional = (bool *)calloc(count, sizeof(bool));
+	culler->conditional_vertices = (u32 *)calloc(count, sizeof(u32));
+	culler->hidden_frames = (u8 *)calloc(count, sizeof(u8));
+	glGenQueries(count, culler->queries);
+
+	glGenQueries(SAMPLE_PASSES, culler->samples_queries);
+	for (u32 p = 0; p < SAMPLE_PASSES; p++) {
+		culler->samples_pending[p] = false;
+	}
+
+	culler->chunks_tested = 0;
+	culler->chunks_hidden = 0;
+	culler->chunks_skipped = 0;
+	culler->vertices_skipped = 0;
+	culler->samples_drawn = 0;
+}
+
+void occlusion_free(OcclusionCuller *culler) {
+	glDeleteQueries(culler->count, culler->queries);
+	glDeleteQueries(SAMPLE_PASSES, culler->samples_queries);
+	glDeleteVertexArrays(1, &culler->vao);
+	glDeleteProgram(culler->program);
+
+	free(culler->queries);
+	free(culler->pending);
+	free(culler->conditional);
+	free(culler->conditional_vertices);
+	free(culler->hidden_frames);
+}
+
+// After the chunks moved between slots, what was learned about each slot is
+// about another chunk
+void occlusion_reset(OcclusionCuller *culler) {
+	for (u32 i = 0; i < culler->count; i++) {
+		culler->pending[i] = false;
+		culler->conditional[i] = false;
+		culler->hidden_frames[i] = 0;
+	}
+}
+
+inline bool occlusion_hidden(OcclusionCuller *culler, u32 i) {
+	return culler->hidden_frames[i] >= OCCLUSION_HIDE_FRAMES;
+}
+
+// Reads whichever results from earlier frames are ready. A slot whose result
+// isn't gets no new query until it is, and its chunk is drawn regardless.
+void occlusion_collect(OcclusionCuller *culler) {
+	for (u32 i = 0; i < culler->count; i++) {
+		if (!culler->pending[i]) {
+			continue;
+		}
+
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(culler->queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			continue;
+		}
+
+		GLuint any_samples = GL_FALSE;
+		glGetQueryObjectuiv(culler->queries[i], GL_QUERY_RESULT, &any_samples);
+		culler->pending[i] = false;
+		culler->chunks_tested++;
+
+		if (any_samples) {
+			culler->hidden_frames[i] = 0;
+		} else if (culler->hidden_frames[i] < OCCLUSION_HIDE_FRAMES) {
+			culler->hidden_frames[i]++;
+		}
+
+		if (culler->conditional[i]) {
+			culler->chunks_hidden++;
+			if (!any_samples) {
+				culler->chunks_skipped++;
+				culler->vertices_skipped += culler->conditional_vertices[i];
+				counter_add(&metrics.chunks_occluded, 1);
+			}
+		}
+	}
+
+	for (u32 p = 0; p < SAMPLE_PASSES; p++) {
+		if (!culler->samples_pending[p]) {
+			continue;
+		}
+
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(culler->samples_queries[p], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available) {
+			GLuint samples = 0;
+			glGetQueryObjectuiv(culler->samples_queries[p], GL_QUERY_RESULT, &samples);
+			culler->samples_pending[p] = false;
+			culler->samples_drawn += samples;
+			counter_add(&metrics.world_samples, samples);
+		}
+	}
+}
+
+// Counts the samples drawn between this and occlusion_end_samples(), skipped
+// while last frame's count for the pass is still out
+bool occlusion_begin_samples(OcclusionCuller *culler, u32 pass) {
+	if (culler->samples_pending[pass]) {
+		return false;
+	}
+
+	glBeginQuery(GL_SAMPLES_PASSED, culler->samples_queries[pass]);
+	culler->samples_pending[pass] = true;
+	return true;
+}
+
+void occlusion_end_samples() {
+	glEndQuery(GL_SAMPLES_PASSED);
+}
+
+void occlusion_begin_boxes(OcclusionCuller *culler, glm::mat4 pv) {
+	glUseProgram(culler->program);
+	glBindVertexArray(culler->vao);
+	glUniformMatrix4fv(culler->u_pv, 1, GL_FALSE, &pv[0][0]);
+
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glDisable(GL_CULL_FACE);
+}
+
+void occlusion_end_boxes() {
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthMask(GL_TRUE);
+	glEnable(GL_CULL_FACE);
+}
+
+// Tests slot i's box against what's been drawn so far. Returns false when no
+// query went out, then the chunk can't be drawn conditionally.
+bool occlusion_test_box(OcclusionCuller *culler, u32 i, glm::vec3 min, glm::vec3 max, glm::vec3 cam_pos) {
+	if (culler->pending[i]) {
+		return false;
+	}
+
+	min -= glm::vec3(OCCLUSION_MARGIN);
+	max += glm::vec3(OCCLUSION_MARGIN);
+
+	glm::vec3 nearest = glm::clamp(cam_pos, min, max);
+	if (glm::length(nearest - cam_pos) < OCCLUSION_NEAR) {
+		culler->hidden_frames[i] = 0;
+		return false;
+	}
+
+	glUniform3fv(culler->u_box_min, 1, &min[0]);
+	glUniform3fv(culler->u_box_max, 1, &max[0]);
+
+	glBeginQuery(GL_ANY_SAMPLES_PASSED, culler->queries[i]);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 14);
+	glEndQuery(GL_ANY_SAMPLES_PASSED);
+
+	culler->pending[i] = true;
+	culler->conditional[i] = false;
+	return true;
+}
+
+// Draws between this and occlusion_end_conditional() only happen if slot i's
+// box showed samples this frame. Waiting on the query happens on the GPU.
+void occlusion_begin_conditional(OcclusionCuller *culler, u32 i) {
+	glBeginConditionalRender(culler->queries[i], GL_QUERY_WAIT);
+}
+
+// vertices is how many were submitted in between, skipped if the box was hidden
+void occlusion_end_conditional(OcclusionCuller *culler, u32 i, u32 vertices) {
+	glEndConditionalRender();
+	culler->conditional[i] = true;
+	culler->conditional_vertices[i] = vertices;
+}
+
+#endif
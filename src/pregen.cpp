@@ -0,0 +1,209 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include <errno.h>
+#include <sys/stat.h>
+
+#define STB_PERLIN_IMPLEMENTATION
+#include "chunk.h"
+#include "world_file.h"
+
+// Headless world baking: generates and meshes every section of a region across
+// all cores and writes them with write_column(). Columns already on disk are
+// skipped, so an interrupted run picks up where it stopped.
+
+#define PROGRESS_INTERVAL_MS 1000
+#define PROGRESS_POLL_MS 20
+
+typedef struct ColumnPos {
+	i64 c_x;
+	i64 c_z;
+} ColumnPos;
+
+typedef struct PregenJob {
+	const char *dir;
+	i64 min_c_y;
+	u32 num_sections;
+
+	ColumnPos *columns;
+	u32 num_columns;
+
+	std::atomic<u32> next;
+	std::atomic<u32> done;
+	std::atomic<u32> skipped;
+	std::atomic<u32> failed;
+	std::atomic<u64> sections;
+	std::atomic<u64> bytes;
+} PregenJob;
+
+void pregen_worker(PregenJob *job) {
+	ChunkColumn<Chunk> column;
+	Chunk **sections = (Chunk **)malloc(sizeof(Chunk *) * job->num_sections);
+
+	for (;;) {
+		u32 i = job->next.fetch_add(1);
+		if (i >= job->num_columns) {
+			break;
+		}
+
+		ColumnPos pos = job->columns[i];
+
+		if (column_file_done<Chunk>(job->dir, pos.c_x, pos.c_z, job->min_c_y, job->num_sections)) {
+			job->skipped++;
+			job->done++;
+			continue;
+		}
+
+		generate_column(&column, pos.c_x, pos.c_z);
+		for (u32 y = 0; y < job->num_sections; y++) {
+			sections[y] = generate_chunk(&column, job->min_c_y + y);
+			generate_mesh(sections[y], NULL);
+		}
+
+		u64 bytes = write_column(job->dir, pos.c_x, pos.c_z, job->min_c_y, sections, job->num_sections);
+		if (bytes == 0) {
+			job->failed++;
+		}
+
+		for (u32 y = 0; y < job->num_sections; y++) {
+			free_chunk(sections[y]);
+		}
+
+		job->sections += job->num_sections;
+		job->bytes += bytes;
+		job->done++;
+	}
+
+	free(sections);
+}
+
+void usage() {
+	printf("usage: pregen [-seed N] [-threads N] [-y MIN MAX] (-rect X0 Z0 X1 Z1 | -radius X Z R) OUT_DIR\n");
+	printf("  -rect     chunk columns X0..X1, Z0..Z1 inclusive\n");
+	printf("  -radius   chunk columns within R of column X, Z, nearest first\n");
+	printf("  -y        world heights in blocks to bake, default -32 192\n");
+}
+
+int main(int argc, char **argv) {
+	i64 x0 = 0, z0 = 0, x1 = -1, z1 = -1;
+	i64 center_x = 0, center_z = 0, radius = -1;
+	i64 min_y = -32, max_y = 192;
+	u32 threads = std::thread::hardware_concurrency();
+	const char *dir = NULL;
+
+	for (i32 i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+			world_seed = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+			threads = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-y") == 0 && i + 2 < argc) {
+			min_y = strtoll(argv[++i], NULL, 10);
+			max_y = strtoll(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-rect") == 0 && i + 4 < argc) {
+			x0 = strtoll(argv[++i], NULL, 10);
+			z0 = strtoll(argv[++i], NULL, 10);
+			x1 = strtoll(argv[++i], NULL, 10);
+			z1 = strtoll(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-radius") == 0 && i + 3 < argc) {
+			center_x = strtoll(argv[++i], NULL, 10);
+			center_z = strtoll(argv[++i], NULL, 10);
+			radius = strtoll(argv[++i], NULL, 10);
+		} else if (argv[i][0] != '-' && dir == NULL) {
+			dir = argv[i];
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	if (dir == NULL || (radius < 0 && (x1 < x0 || z1 < z0)) || max_y <= min_y) {
+		usage();
+		return 1;
+	}
+	if (threads == 0) {
+		threads = 1;
+	}
+
+	struct stat dir_stat;
+	if (mkdir(dir, 0755) != 0 && (errno != EEXIST || stat(dir, &dir_stat) != 0 || !S_ISDIR(dir_stat.st_mode))) {
+		printf("can't create %s: %s\n", dir, errno == EEXIST ? "not a directory" : strerror(errno));
+		return 1;
+	}
+
+	std::vector<ColumnPos> columns;
+	if (radius >= 0) {
+		for (i64 x = center_x - radius; x <= center_x + radius; x++) {
+			for (i64 z = center_z - radius; z <= center_z + radius; z++) {
+				if ((x - center_x) * (x - center_x) + (z - center_z) * (z - center_z) <= radius * radius) {
+					columns.push_back({x, z});
+				}
+			}
+		}
+
+		// Nearest first, so a partial bake is useful around the spawn
+		std::sort(columns.begin(), columns.end(), [=](const ColumnPos &a, const ColumnPos &b) {
+			return (a.c_x - center_x) * (a.c_x - center_x) + (a.c_z - center_z) * (a.c_z - center_z)
+				< (b.c_x - center_x) * (b.c_x - center_x) + (b.c_z - center_z) * (b.c_z - center_z);
+		});
+	} else {
+		for (i64 x = x0; x <= x1; x++) {
+			for (i64 z = z0; z <= z1; z++) {
+				columns.push_back({x, z});
+			}
+		}
+	}
+
+	PregenJob job;
+	job.dir = dir;
+	job.min_c_y = floor_div(min_y, CHUNK_HEIGHT);
+	job.num_sections = floor_div(max_y - 1, CHUNK_HEIGHT) - job.min_c_y + 1;
+	job.columns = columns.data();
+	job.num_columns = columns.size();
+	job.next = 0;
+	job.done = 0;
+	job.skipped = 0;
+	job.failed = 0;
+	job.sections = 0;
+	job.bytes = 0;
+
+	printf("seed %u, %u columns of %u %ux%ux%u sections, %u threads -> %s\n", world_seed, job.num_columns, job.num_sections, CHUNK_WIDTH, CHUNK_HEIGHT, CHUNK_DEPTH, threads, dir);
+
+	metrics_init();
+
+	u64 start = metrics_now_ns();
+
+	std::vector<std::thread> workers;
+	for (u32 i = 0; i < threads; i++) {
+		workers.push_back(std::thread(pregen_worker, &job));
+	}
+
+	u64 next_report = start + (u64)PROGRESS_INTERVAL_MS * 1000000;
+	while (job.done < job.num_columns) {
+		usleep(PROGRESS_POLL_MS * 1000);
+		if (metrics_now_ns() < next_report && job.done < job.num_columns) {
+			continue;
+		}
+		next_report += (u64)PROGRESS_INTERVAL_MS * 1000000;
+
+		f64 seconds = (metrics_now_ns() - start) / 1e9;
+		u32 done = job.done;
+		u32 baked = done - job.skipped;
+		f64 rate = baked / seconds;
+		f64 eta = rate > 0.0 ? (job.num_columns - done) / rate : 0.0;
+
+		printf("%u/%u columns (%.1f%%, %u already done), %.1f columns/s, %.1f sections/s, %.1f MiB, eta %.0fs\n",
+			done, job.num_columns, 100.0 * done / job.num_columns, (u32)job.skipped, rate, job.sections / seconds, job.bytes / (1024.0 * 1024.0), eta);
+	}
+
+	for (u32 i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+
+	f64 seconds = (metrics_now_ns() - start) / 1e9;
+	printf("baked %llu sections in %.2fs (%.1f sections/s), %.1f MiB written, %u skipped, %u failed\n",
+		(unsigned long long)job.sections, seconds, job.sections / seconds, job.bytes / (1024.0 * 1024.0), (u32)job.skipped, (u32)job.failed);
+
+	return job.failed > 0 ? 1 : 0;
+}
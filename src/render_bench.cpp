@@ -0,0 +1,248 @@
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glcorearb.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#define STB_PERLIN_IMPLEMENTATION
+#include "chunk.h"
+#include "gl_helper.h"
+#include "occlusion.h"
+#include "world_render.h"
+
+// Headless world rendering without SDL or a display: an EGL context (Mesa's
+// llvmpipe on machines without a GPU) draws the viewer's area into an
+// offscreen framebuffer along the viewer's SNOW_BENCH_FRAMES flight, once in
+// slot order without culling and once front to back with occlusion culling.
+// Each frame is finished before the next so the times are the renderer's.
+// Snow, its cover and streaming aren't drawn, and the atlas is a flat stand-in.
+
+#define BENCH_VIEW_WIDTH 208
+#define BENCH_CHUNKS_X (BENCH_VIEW_WIDTH / CHUNK_WIDTH)
+#define BENCH_CHUNKS_Y 9
+#define BENCH_CHUNKS_Z (BENCH_VIEW_WIDTH / CHUNK_DEPTH)
+#define BENCH_COUNT (BENCH_CHUNKS_X * BENCH_CHUNKS_Y * BENCH_CHUNKS_Z)
+
+// Lowest section layer, the flight stays between 32 and 128 blocks up
+#define BENCH_MIN_C_Y -2
+
+#define BENCH_SCREEN_WIDTH 640
+#define BENCH_SCREEN_HEIGHT 480
+#define BENCH_DEFAULT_FRAMES 500
+
+typedef struct BenchWorld {
+	Chunk *chunks[BENCH_COUNT];
+	u32 draw_first[BENCH_COUNT];
+	bool on_gpu[BENCH_COUNT];
+} BenchWorld;
+
+bool bench_context() {
+	EGLDisplay display = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_platform_display != NULL) {
+		display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if (display == EGL_NO_DISPLAY) {
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+		printf("no EGL display\n");
+		return false;
+	}
+
+	// Drawing goes to a framebuffer object, so any config will do whatever surfaces it supports
+	EGLint config_attribs[] = { EGL_SURFACE_TYPE, 0, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config;
+	EGLint num_configs = 0;
+	if (!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) || num_configs == 0 || !eglBindAPI(EGL_OPENGL_API)) {
+		printf("no EGL config for desktop GL\n");
+		return false;
+	}
+
+	EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE,
+	};
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		printf("can't create a GL 3.3 core context without a surface\n");
+		return false;
+	}
+	return true;
+}
+
+void bench_framebuffer() {
+	GLuint fbo;
+	GLuint renderbuffers[2];
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glGenRenderbuffers(2, renderbuffers);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, BENCH_SCREEN_WIDTH, BENCH_SCREEN_HEIGHT);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, BENCH_SCREEN_WIDTH, BENCH_SCREEN_HEIGHT);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+
+	glViewport(0, 0, BENCH_SCREEN_WIDTH, BENCH_SCREEN_HEIGHT);
+}
+
+// Generates and meshes the area and lays the meshes out one after another, returns the vertices
+u64 bench_upload(BenchWorld *world) {
+	u64 total = 0;
+	ChunkColumn<Chunk> column;
+	for (u32 x = 0; x < BENCH_CHUNKS_X; x++) {
+		for (u32 z = 0; z < BENCH_CHUNKS_Z; z++) {
+			generate_column(&column, x, z);
+			for (u32 y = 0; y < BENCH_CHUNKS_Y; y++) {
+				u32 i = COMPRESS_THREE(x, y, z, BENCH_CHUNKS_X, BENCH_CHUNKS_Y);
+				world->chunks[i] = generate_chunk(&column, (i64)BENCH_MIN_C_Y + y);
+				generate_mesh(world->chunks[i], NULL);
+				world->draw_first[i] = total;
+				world->on_gpu[i] = true;
+				total += world->chunks[i]->mesh_size;
+			}
+		}
+	}
+
+	glBufferData(GL_ARRAY_BUFFER, total * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+	for (u32 i = 0; i < BENCH_COUNT; i++) {
+		Chunk *chunk = world->chunks[i];
+		glBufferSubData(GL_ARRAY_BUFFER, (u64)world->draw_first[i] * sizeof(Vertex), chunk->mesh_size * sizeof(Vertex), chunk->mesh);
+	}
+	return total;
+}
+
+void bench_flight(WorldDraw *draws, OcclusionCuller *culler, bool occluding, GLuint program, GLuint vao, u32 frames) {
+	GLint u_pv = glGetUniformLocation(program, "pv");
+	u64 samples = culler->samples_drawn;
+	u64 skipped = culler->chunks_skipped;
+	u64 vertices_skipped = culler->vertices_skipped;
+	occlusion_reset(culler);
+
+	DrawStats stats;
+	bzero(&stats, sizeof(DrawStats));
+
+	u64 worst = 0;
+	u64 start = metrics_now_ns();
+	for (u32 frame = 0; frame < frames; frame++) {
+		u64 frame_start = metrics_now_ns();
+
+		glm::vec3 cam_pos, cam_front;
+		bench_camera(frame, BENCH_VIEW_WIDTH, &cam_pos, &cam_front);
+		glm::mat4 projection = glm::perspective(glm::radians(45.0f), (f32)BENCH_SCREEN_WIDTH / BENCH_SCREEN_HEIGHT, 1.0f, 500.0f);
+		glm::mat4 pv = projection * glm::lookAt(cam_pos, cam_pos + cam_front, glm::vec3(0.0f, 1.0f, 0.0f));
+
+		glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+		glUseProgram(program);
+		glBindVertexArray(vao);
+		glUniformMatrix4fv(u_pv, 1, GL_FALSE, &pv[0][0]);
+		draw_world(draws, culler, occluding, program, vao, pv, cam_pos, &stats);
+		glFinish();
+
+		u64 frame_ns = metrics_now_ns() - frame_start;
+		if (frame_ns > worst) {
+			worst = frame_ns;
+		}
+	}
+	f64 seconds = (metrics_now_ns() - start) / 1e9;
+
+	// The last frame's counts come in a frame late
+	occlusion_collect(culler);
+
+	printf("render: occlusion culling %s, %.3f ms/frame avg, %.3f ms worst, %.0fk pixels drawn, %.1f chunks and %llu of %llu vertices skipped per frame\n",
+		occluding ? "on" : "off", seconds * 1000.0 / frames, worst / 1e6, (culler->samples_drawn - samples) / 1000.0 / frames,
+		(f64)(culler->chunks_skipped - skipped) / frames, (unsigned long long)((culler->vertices_skipped - vertices_skipped) / frames),
+		(unsigned long long)(stats.vertices_drawn / frames));
+}
+
+int main(int argc, char **argv) {
+	u32 frames = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_FRAMES;
+	if (frames == 0) {
+		printf("usage: render_bench [FRAMES]\n");
+		return 1;
+	}
+
+	if (!bench_context()) {
+		return 1;
+	}
+	printf("%s, %ux%u, %ux%ux%u sections, %u frames\n", glGetString(GL_RENDERER), BENCH_SCREEN_WIDTH, BENCH_SCREEN_HEIGHT, BENCH_CHUNKS_X, BENCH_CHUNKS_Y,
+		BENCH_CHUNKS_Z, frames);
+
+	metrics_init();
+	bench_framebuffer();
+
+	GLuint program = load_and_build_program("src/obj_vert.vsh", "src/obj_frag.fsh");
+	glUseProgram(program);
+
+	GLuint vao;
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+	BenchWorld *world = (BenchWorld *)malloc(sizeof(BenchWorld));
+	u64 vertices = bench_upload(world);
+	printf("%.1f MiB of vertices\n", vertices * sizeof(Vertex) / (1024.0 * 1024.0));
+
+	GLuint a_points = glGetAttribLocation(program, "points");
+	GLuint a_tex_side = glGetAttribLocation(program, "tex_side");
+	GLuint a_tex_idx = glGetAttribLocation(program, "tex_idx");
+	GLuint a_ao = glGetAttribLocation(program, "ao");
+	glEnableVertexAttribArray(a_points);
+	glEnableVertexAttribArray(a_tex_side);
+	glEnableVertexAttribArray(a_tex_idx);
+	glEnableVertexAttribArray(a_ao);
+	glVertexAttribPointer(a_points, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
+	glVertexAttribIPointer(a_tex_side, 1, GL_UNSIGNED_BYTE, sizeof(Vertex), (void *)STRUCT_OFFSET(Vertex, t_point));
+	glVertexAttribIPointer(a_tex_idx, 1, GL_UNSIGNED_BYTE, sizeof(Vertex), (void *)STRUCT_OFFSET(Vertex, tex_id));
+	glVertexAttribIPointer(a_ao, 1, GL_UNSIGNED_BYTE, sizeof(Vertex), (void *)STRUCT_OFFSET(Vertex, ao));
+
+	// Four flat colours where the viewer loads assets/atlas.png
+	u32 atlas[4] = { 0xff3a8c4a, 0xff6b4a2e, 0xff808080, 0xfff0f0f0 };
+	GLuint atlas_tex;
+	glGenTextures(1, &atlas_tex);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, atlas_tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, atlas);
+
+	glm::mat4 model = glm::mat4(1.0);
+	glUniform1i(glGetUniformLocation(program, "tex"), 0);
+	glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, &model[0][0]);
+
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_FRONT);
+	glFrontFace(GL_CW);
+
+	WorldDraw draws;
+	world_draw_init(&draws, BENCH_COUNT, world->chunks, world->draw_first, world->on_gpu);
+	OcclusionCuller culler;
+	occlusion_init(&culler, BENCH_COUNT);
+
+	bench_flight(&draws, &culler, false, program, vao, frames);
+	bench_flight(&draws, &culler, true, program, vao, frames);
+
+	GLenum err = glGetError();
+	if (err != GL_NO_ERROR) {
+		printf("GL error 0x%x\n", err);
+		return 1;
+	}
+
+	occlusion_free(&culler);
+	world_draw_free(&draws);
+	for (u32 i = 0; i < BENCH_COUNT; i++) {
+		free_chunk(world->chunks[i]);
+	}
+	free(world);
+	return 0;
+}
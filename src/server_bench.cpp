@@ -0,0 +1,310 @@
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#define STB_PERLIN_IMPLEMENTATION
+#include "chunk.h"
+#include "world_server.h"
+
+// Loopback world server: runs a server on its own thread and a Unix socket, then
+// as a viewer requests a region in random order and measures how fast and in
+// what order it arrives, cold and from the server's memory. A second viewer then
+// holds the same region while the first edits blocks one at a time, timing the
+// round trip of each edit to both. Both let go of the region and the first one
+// loads another next to it, which makes the server, capped at one region, free
+// the sections nobody holds. The first region is then requested again. Every
+// copy the viewers end up with is checked against the server's.
+
+#define BENCH_SOCKET "/tmp/snow_server_bench.sock"
+#define BENCH_CHUNKS_X 12
+#define BENCH_CHUNKS_Y 8
+#define BENCH_CHUNKS_Z 12
+#define BENCH_MIN_C_Y -2
+#define BENCH_EDITS 200
+
+typedef std::unordered_map<u64, Chunk *> ViewerSections;
+
+std::atomic<bool> bench_serving(true);
+
+u64 percentile(std::vector<u64> values, f64 p) {
+	if (values.empty()) {
+		return 0;
+	}
+	std::sort(values.begin(), values.end());
+	return values[std::min((size_t)(p * values.size()), values.size() - 1)];
+}
+
+// Keeps every section and delta the viewer receives, returns the number of each seen
+void receive(WorldClient *client, ViewerSections *sections, i32 timeout_ms, u32 *num_sections, u32 *num_deltas, std::vector<u64> *delta_keys) {
+	world_client_receive(client, timeout_ms, [&](u32 type, u8 *payload, u32 size) {
+		if (type == MSG_SECTION) {
+			Chunk *chunk = section_decode<Chunk>(payload, size);
+			if (chunk == NULL) {
+				printf("Malformed section!\n");
+				return;
+			}
+
+			u64 key = section_key(chunk_section_pos(chunk));
+			auto it = sections->find(key);
+			if (it != sections->end()) {
+				free_chunk(it->second);
+			}
+			(*sections)[key] = chunk;
+			(*num_sections)++;
+		} else if (type == MSG_DELTA) {
+			SectionPos pos;
+			if (!delta_pos(payload, size, &pos)) {
+				return;
+			}
+
+			auto it = sections->find(section_key(pos));
+			if (it != sections->end() && !delta_apply(it->second, payload, size)) {
+				printf("Malformed delta!\n");
+			}
+			(*num_deltas)++;
+			if (delta_keys != NULL) {
+				delta_keys->push_back(section_key(pos));
+			}
+		}
+	});
+}
+
+// Requests the whole region, shifted by offset_x sections, in a shuffled order and waits for all of it
+void bench_region(WorldClient *client, ViewerSections *sections, const char *label, i32 offset_x) {
+	std::vector<SectionPos> positions;
+	for (i32 x = 0; x < BENCH_CHUNKS_X; x++) {
+		for (i32 y = 0; y < BENCH_CHUNKS_Y; y++) {
+			for (i32 z = 0; z < BENCH_CHUNKS_Z; z++) {
+				positions.push_back({ x - BENCH_CHUNKS_X / 2 + offset_x, BENCH_MIN_C_Y + y, z - BENCH_CHUNKS_Z / 2 });
+			}
+		}
+	}
+
+	u32 rng = 0x2545f491;
+	for (u32 i = positions.size() - 1; i > 0; i--) {
+		std::swap(positions[i], positions[tick_rand(&rng) % (i + 1)]);
+	}
+
+	u64 bytes_before = client->bytes_received;
+	u64 raw_before = metrics.server_raw_bytes.value;
+	u64 start = metrics_now_ns();
+	world_client_request(client, positions.data(), positions.size());
+
+	std::unordered_map<u64, u64> arrived;
+	u32 count = 0;
+	u32 deltas = 0;
+	while (count < positions.size()) {
+		u32 before = count;
+		receive(client, sections, 100, &count, &deltas, NULL);
+
+		u64 now = metrics_now_ns() - start;
+		for (auto it = sections->begin(); it != sections->end() && count != before; ++it) {
+			if (arrived.count(it->first) == 0) {
+				arrived[it->first] = now;
+			}
+		}
+	}
+	f64 seconds = (metrics_now_ns() - start) / 1e9;
+
+	// Arrival times of the nearest and farthest quarter of the region from the viewer at the origin
+	std::sort(positions.begin(), positions.end(), [](const SectionPos &a, const SectionPos &b) {
+		f32 ax = (a.c_x + 0.5f) * Chunk::width, ay = (a.c_y + 0.5f) * Chunk::height - 50.0f, az = (a.c_z + 0.5f) * Chunk::depth;
+		f32 bx = (b.c_x + 0.5f) * Chunk::width, by = (b.c_y + 0.5f) * Chunk::height - 50.0f, bz = (b.c_z + 0.5f) * Chunk::depth;
+		return ax * ax + ay * ay + az * az < bx * bx + by * by + bz * bz;
+	});
+	std::vector<u64> all, nearest, farthest;
+	for (u32 i = 0; i < positions.size(); i++) {
+		u64 t = arrived[section_key(positions[i])];
+		all.push_back(t);
+		if (i < positions.size() / 4) {
+			nearest.push_back(t);
+		} else if (i >= positions.size() * 3 / 4) {
+			farthest.push_back(t);
+		}
+	}
+
+	u64 wire = client->bytes_received - bytes_before;
+	u64 raw = metrics.server_raw_bytes.value - raw_before;
+	printf("  %s: %u sections in %.1f ms, %.0f sections/s, %.1f MiB at %.1f MiB/s (%.2f:1 against %.1f MiB in memory)\n",
+		label, count, seconds * 1000.0, count / seconds, wire / (1024.0 * 1024.0), wire / (1024.0 * 1024.0) / seconds, (f64)raw / wire, raw / (1024.0 * 1024.0));
+	printf("    arrival p50 %.1f ms, p99 %.1f ms; nearest quarter p50 %.1f ms, farthest quarter p50 %.1f ms\n",
+		percentile(all, 0.5) / 1e6, percentile(all, 0.99) / 1e6, percentile(nearest, 0.5) / 1e6, percentile(farthest, 0.5) / 1e6);
+}
+
+// True when the viewer's copy of every section has the server's blocks and mesh
+u32 compare_sections(ViewerSections *sections, WorldServer<Chunk> *server) {
+	u32 mismatched = 0;
+	for (auto it = sections->begin(); it != sections->end(); ++it) {
+		Chunk *ours = it->second;
+		Chunk *theirs = server->sections[it->first];
+		bool same = ours->mesh_size == theirs->mesh_size && memcmp(ours->bucket_start, theirs->bucket_start, sizeof(ours->bucket_start)) == 0;
+		for (u32 x = 0; same && x <= Chunk::width + 1; x++) {
+			for (u32 y = 0; same && y <= Chunk::height + 1; y++) {
+				for (u32 z = 0; same && z <= Chunk::depth + 1; z++) {
+					same = chunk_block(ours, x, y, z) == chunk_block(theirs, x, y, z);
+				}
+			}
+		}
+		for (u32 i = 0; same && i < ours->mesh_size; i++) {
+			same = ours->mesh[i].point == theirs->mesh[i].point && ours->mesh[i].t_point == theirs->mesh[i].t_point
+				&& ours->mesh[i].tex_id == theirs->mesh[i].tex_id && ours->mesh[i].ao == theirs->mesh[i].ao;
+		}
+		if (!same) {
+			mismatched++;
+		}
+	}
+	return mismatched;
+}
+
+void free_sections(ViewerSections *sections) {
+	for (auto it = sections->begin(); it != sections->end(); ++it) {
+		free_chunk(it->second);
+	}
+	sections->clear();
+}
+
+int main() {
+	metrics_init();
+
+	u32 cores = std::max(std::thread::hardware_concurrency(), 1u);
+	JobPool pool;
+	job_pool_start(&pool, cores - 1);
+
+	WorldServer<Chunk> server;
+	if (!world_server_start(&server, BENCH_SOCKET, NULL, &pool)) {
+		return 1;
+	}
+	server.max_sections = BENCH_CHUNKS_X * BENCH_CHUNKS_Y * BENCH_CHUNKS_Z;
+	std::thread server_thread([&]() {
+		while (bench_serving) {
+			world_server_poll(&server, 10);
+		}
+	});
+
+	WorldClient viewer;
+	WorldClient watcher;
+	if (!world_client_connect(&viewer, BENCH_SOCKET) || !world_client_connect(&watcher, BENCH_SOCKET)) {
+		return 1;
+	}
+	world_client_viewer(&viewer, 0.0f, 50.0f, 0.0f);
+	world_client_viewer(&watcher, 0.0f, 50.0f, 0.0f);
+
+	ViewerSections viewer_sections;
+	ViewerSections watcher_sections;
+
+	printf("world server over %s, %ux%ux%u sections, %u threads\n", BENCH_SOCKET, BENCH_CHUNKS_X, BENCH_CHUNKS_Y, BENCH_CHUNKS_Z, cores);
+	bench_region(&viewer, &viewer_sections, "cold", 0);
+
+	std::vector<SectionPos> held;
+	for (auto it = viewer_sections.begin(); it != viewer_sections.end(); ++it) {
+		held.push_back(chunk_section_pos(it->second));
+	}
+	world_client_drop(&viewer, held.data(), held.size());
+	free_sections(&viewer_sections);
+
+	bench_region(&viewer, &viewer_sections, "warm", 0);
+	bench_region(&watcher, &watcher_sections, "second viewer", 0);
+
+	// Toggle snow on top of the terrain around the origin, one edit at a time
+	std::vector<u64> viewer_latency, watcher_latency;
+	u64 delta_bytes = 0;
+	u64 resend_bytes = 0;
+	u32 deltas = 0;
+	u32 rng = 0x9e3779b9;
+	for (u32 i = 0; i < BENCH_EDITS; i++) {
+		BlockEdit edit;
+		memset(&edit, 0, sizeof(edit));
+		edit.x = (i32)(tick_rand(&rng) % 256) - 128;
+		edit.z = (i32)(tick_rand(&rng) % 256) - 128;
+		edit.y = (i32)ceilf(terrain_height(edit.x, edit.z));
+
+		SectionPos owner = { (i32)floor_div(edit.x - 1, CHUNK_WIDTH), (i32)floor_div(edit.y - 1, CHUNK_HEIGHT), (i32)floor_div(edit.z - 1, CHUNK_DEPTH) };
+		u64 key = section_key(owner);
+		if (viewer_sections.count(key) == 0) {
+			continue;
+		}
+
+		// An edit that changes nothing gets no delta, so toggle whatever is there
+		Chunk *chunk = viewer_sections[key];
+		u8 current = chunk_block(chunk, edit.x - chunk->x_off, edit.y - chunk->y_off, edit.z - chunk->z_off);
+		edit.block = current == BLOCK_AIR ? BLOCK_SNOW : BLOCK_AIR;
+
+		u64 bytes_before = viewer.bytes_received;
+		u64 start = metrics_now_ns();
+		world_client_edit(&viewer, &edit, 1);
+
+		bool viewer_done = false;
+		bool watcher_done = false;
+		std::vector<u64> changed;
+		while (!viewer_done || !watcher_done) {
+			std::vector<u64> keys;
+			u32 sections = 0;
+			if (!viewer_done) {
+				receive(&viewer, &viewer_sections, 100, &sections, &deltas, &changed);
+				if (std::find(changed.begin(), changed.end(), key) != changed.end()) {
+					viewer_latency.push_back(metrics_now_ns() - start);
+					viewer_done = true;
+				}
+			}
+			if (!watcher_done) {
+				receive(&watcher, &watcher_sections, 100, &sections, &deltas, &keys);
+				if (std::find(keys.begin(), keys.end(), key) != keys.end()) {
+					watcher_latency.push_back(metrics_now_ns() - start);
+					watcher_done = true;
+				}
+			}
+		}
+		delta_bytes += viewer.bytes_received - bytes_before;
+
+		// What sending the changed sections whole would have cost instead
+		for (u32 c = 0; c < changed.size(); c++) {
+			ByteBuffer message;
+			memset(&message, 0, sizeof(message));
+			section_encode(&message, viewer_sections[changed[c]]);
+			resend_bytes += message.size;
+			byte_buffer_free(&message);
+		}
+	}
+
+	printf("  edits: %u round trips, editing viewer p50 %.1f us p99 %.1f us, second viewer p50 %.1f us p99 %.1f us\n",
+		(u32)viewer_latency.size(), percentile(viewer_latency, 0.5) / 1e3, percentile(viewer_latency, 0.99) / 1e3,
+		percentile(watcher_latency, 0.5) / 1e3, percentile(watcher_latency, 0.99) / 1e3);
+	printf("    %.2f KiB of deltas per edit against %.2f KiB for the changed sections whole\n",
+		viewer_latency.empty() ? 0.0 : delta_bytes / 1024.0 / viewer_latency.size(), viewer_latency.empty() ? 0.0 : resend_bytes / 1024.0 / viewer_latency.size());
+
+	// The watcher keeps its copies to check against the sections generated again
+	world_client_drop(&watcher, held.data(), held.size());
+	world_client_drop(&viewer, held.data(), held.size());
+	free_sections(&viewer_sections);
+	u64 evicted = metrics.server_sections_evicted.value;
+	bench_region(&viewer, &viewer_sections, "next region", BENCH_CHUNKS_X);
+
+	std::vector<SectionPos> next;
+	for (auto it = viewer_sections.begin(); it != viewer_sections.end(); ++it) {
+		next.push_back(chunk_section_pos(it->second));
+	}
+	world_client_drop(&viewer, next.data(), next.size());
+	free_sections(&viewer_sections);
+	bench_region(&viewer, &viewer_sections, "back after eviction", 0);
+	printf("  %llu sections freed by the server, %u edited ones kept\n", (unsigned long long)(metrics.server_sections_evicted.value - evicted),
+		(u32)server.edited.size());
+
+	bench_serving = false;
+	server_thread.join();
+
+	u32 viewer_mismatched = compare_sections(&viewer_sections, &server);
+	u32 watcher_mismatched = compare_sections(&watcher_sections, &server);
+	printf("  copies matching the server: %u/%u and %u/%u\n", (u32)viewer_sections.size() - viewer_mismatched, (u32)viewer_sections.size(),
+		(u32)watcher_sections.size() - watcher_mismatched, (u32)watcher_sections.size());
+
+	world_client_close(&viewer);
+	world_client_close(&watcher);
+	free_sections(&viewer_sections);
+	free_sections(&watcher_sections);
+	world_server_stop(&server);
+	job_pool_stop(&pool);
+
+	return viewer_mismatched + watcher_mismatched == 0 ? 0 : 1;
+}
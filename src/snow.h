@@ -0,0 +1,194 @@
+#ifndef SNOW_H
+#define SNOW_H
+
+#include <float.h>
+#include <math.h>
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "jobs.h"
+#include "metrics.h"
+
+// Falling snow, kept as structure-of-arrays so the integration step runs eight
+// flakes per instruction and the position arrays can be uploaded unchanged.
+// Flakes live in a box centred on the camera: ones that drift out of it wrap to
+// the other side, ones that land on the terrain respawn at the top.
+
+#define SNOW_LANES 8
+#define SNOW_TASK_SIZE 16384
+
+// Fall speed and sideways sway of a flake, in blocks per second
+#define SNOW_MIN_FALL 1.5f
+#define SNOW_MAX_FALL 3.5f
+#define SNOW_MAX_DRIFT 1.2f
+
+typedef f32 f32x8 __attribute__((vector_size(SNOW_LANES * sizeof(f32))));
+
+typedef struct SnowField {
+	// Rounded up to SNOW_LANES, SNOW_LANES aligned
+	u32 count;
+
+	f32 *x;
+	f32 *y;
+	f32 *z;
+	f32 *fall;
+	f32 *drift;
+
+	glm::vec3 extent;
+	glm::vec3 wind;
+	f32 time;
+	u32 frame;
+} SnowField;
+
+// Height of the top of the highest solid block in each world column, -FLT_MAX
+// where a column has none. Rebuilt whenever the world's blocks change.
+typedef struct SurfaceMap {
+	f32 *heights;
+	i64 origin_x;
+	i64 origin_z;
+	u32 size_x;
+	u32 size_z;
+} SurfaceMap;
+
+inline u32 snow_rand(u32 *state) {
+	u32 x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+inline f32 snow_randf(u32 *state) {
+	return (snow_rand(state) >> 8) * (1.0f / 16777216.0f);
+}
+
+inline f32 surface_height(SurfaceMap *surface, f32 x, f32 z) {
+	i64 ix = (i64)floorf(x) - surface->origin_x;
+	i64 iz = (i64)floorf(z) - surface->origin_z;
+	if (ix < 0 || iz < 0 || ix >= surface->size_x || iz >= surface->size_z) {
+		return -FLT_MAX;
+	}
+	return surface->heights[COMPRESS_TWO(ix, iz, surface->size_x)];
+}
+
+f32 *snow_alloc(u32 count) {
+	void *data = NULL;
+	if (posix_memalign(&data, sizeof(f32x8), count * sizeof(f32)) != 0) {
+		return NULL;
+	}
+	return (f32 *)data;
+}
+
+void snow_init(SnowField *snow, u32 count, glm::vec3 cam_pos, glm::vec3 extent) {
+	count = (count + SNOW_LANES - 1) / SNOW_LANES * SNOW_LANES;
+
+	snow->count = count;
+	snow->x = snow_alloc(count);
+	snow->y = snow_alloc(count);
+	snow->z = snow_alloc(count);
+	snow->fall = snow_alloc(count);
+	snow->drift = snow_alloc(count);
+	snow->extent = extent;
+	snow->wind = glm::vec3(0.6f, 0.0f, 0.25f);
+	snow->time = 0.0f;
+	snow->frame = 0;
+
+	u32 rng = 0x9e3779b9;
+	for (u32 i = 0; i < count; i++) {
+		snow->x[i] = cam_pos.x + (snow_randf(&rng) - 0.5f) * extent.x;
+		snow->y[i] = cam_pos.y + (snow_randf(&rng) - 0.5f) * extent.y;
+		snow->z[i] = cam_pos.z + (snow_randf(&rng) - 0.5f) * extent.z;
+		snow->fall[i] = SNOW_MIN_FALL + snow_randf(&rng) * (SNOW_MAX_FALL - SNOW_MIN_FALL);
+		snow->drift[i] = (snow_randf(&rng) * 2.0f - 1.0f) * SNOW_MAX_DRIFT;
+	}
+}
+
+void snow_free(SnowField *snow) {
+	free(snow->x);
+	free(snow->y);
+	free(snow->z);
+	free(snow->fall);
+	free(snow->drift);
+}
+
+// Wind, sway and gravity for flakes [begin, end), both multiples of SNOW_LANES
+void snow_integrate(SnowField *snow, f32 dt, u32 begin, u32 end) {
+	f32x8 *x = (f32x8 *)(snow->x + begin);
+	f32x8 *y = (f32x8 *)(snow->y + begin);
+	f32x8 *z = (f32x8 *)(snow->z + begin);
+	f32x8 *fall = (f32x8 *)(snow->fall + begin);
+	f32x8 *drift = (f32x8 *)(snow->drift + begin);
+
+	// Every flake sways in step but by its own amount, so one sin per frame is enough
+	f32 sway_x = sinf(snow->time * 1.3f);
+	f32 sway_z = cosf(snow->time * 0.9f);
+	f32 wind_x = snow->wind.x * dt;
+	f32 wind_z = snow->wind.z * dt;
+
+	u32 n = (end - begin) / SNOW_LANES;
+	for (u32 i = 0; i < n; i++) {
+		f32x8 d = drift[i] * dt;
+		x[i] += wind_x + d * sway_x;
+		y[i] -= fall[i] * dt;
+		z[i] += wind_z + d * sway_z;
+	}
+}
+
+// Keeps flakes [begin, end) inside the camera box and respawns the ones that hit the ground
+void snow_recycle(SnowField *snow, SurfaceMap *surface, glm::vec3 cam_pos, u32 begin, u32 end, u32 seed) {
+	f32 *x = snow->x;
+	f32 *y = snow->y;
+	f32 *z = snow->z;
+	glm::vec3 half = snow->extent * 0.5f;
+	u32 rng = seed | 1;
+
+	for (u32 i = begin; i < end; i++) {
+		if (x[i] < cam_pos.x - half.x) {
+			x[i] += snow->extent.x;
+		} else if (x[i] >= cam_pos.x + half.x) {
+			x[i] -= snow->extent.x;
+		}
+		if (z[i] < cam_pos.z - half.z) {
+			z[i] += snow->extent.z;
+		} else if (z[i] >= cam_pos.z + half.z) {
+			z[i] -= snow->extent.z;
+		}
+		if (y[i] >= cam_pos.y + half.y) {
+			y[i] -= snow->extent.y;
+		}
+
+		if (y[i] < cam_pos.y - half.y || y[i] < surface_height(surface, x[i], z[i])) {
+			x[i] = cam_pos.x + (snow_randf(&rng) - 0.5f) * snow->extent.x;
+			y[i] = cam_pos.y + half.y - snow_randf(&rng) * 2.0f;
+			z[i] = cam_pos.z + (snow_randf(&rng) - 0.5f) * snow->extent.z;
+		}
+	}
+}
+
+// Advances every flake by dt seconds, split over the pool. Returns the time taken in ns.
+u64 snow_simulate(SnowField *snow, SurfaceMap *surface, JobPool *pool, glm::vec3 cam_pos, f32 dt) {
+	u64 start = metrics_now_ns();
+
+	snow->time += dt;
+	snow->frame++;
+
+	u32 tasks = (snow->count + SNOW_TASK_SIZE - 1) / SNOW_TASK_SIZE;
+	job_pool_run(pool, tasks, [=](u32 task) {
+		u32 begin = task * SNOW_TASK_SIZE;
+		u32 end = begin + SNOW_TASK_SIZE;
+		if (end > snow->count) {
+			end = snow->count;
+		}
+
+		snow_integrate(snow, dt, begin, end);
+		snow_recycle(snow, surface, cam_pos, begin, end, (snow->frame * 0x9e3779b9u) ^ (task * 0x85ebca6bu));
+	});
+
+	u64 elapsed = metrics_now_ns() - start;
+	counter_add(&metrics.snow_flakes_simulated, snow->count);
+	histogram_observe(&metrics.snow_sim_time, elapsed);
+	return elapsed;
+}
+
+#endif
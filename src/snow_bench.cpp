@@ -0,0 +1,132 @@
+#include <chrono>
+#include <algorithm>
+
+#define STB_PERLIN_IMPLEMENTATION
+#include "chunk.h"
+#include "snow.h"
+#include "snow_cover.h"
+
+// Headless snowfall over generated terrain: the same flakes are stepped at a
+// fixed 60Hz on 1..N threads, reporting ns per flake and the bytes the viewer
+// would upload per frame. Then the snow cover is ticked over areas as large as
+// the viewer's and larger, reporting the cost and upload size per tick.
+
+#define BENCH_WIDTH 256
+#define BENCH_FRAMES 200
+#define BENCH_RUNS 3
+#define BENCH_COVER_TICKS 2000
+
+typedef SnowCover<32, 32> BenchCover;
+
+f64 elapsed_ms(std::chrono::high_resolution_clock::time_point start) {
+	std::chrono::duration<f64, std::milli> d = std::chrono::high_resolution_clock::now() - start;
+	return d.count();
+}
+
+void bench_flakes(SurfaceMap *surface, u32 count, u32 threads) {
+	JobPool pool;
+	job_pool_start(&pool, threads - 1);
+
+	glm::vec3 cam_pos = glm::vec3(BENCH_WIDTH / 2.0f, 60.0f, BENCH_WIDTH / 2.0f);
+	f64 best_ms = DBL_MAX;
+
+	for (u32 run = 0; run < BENCH_RUNS; run++) {
+		SnowField snow;
+		snow_init(&snow, count, cam_pos, glm::vec3(128.0f, 96.0f, 128.0f));
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (u32 frame = 0; frame < BENCH_FRAMES; frame++) {
+			snow_simulate(&snow, surface, &pool, cam_pos, 1.0f / 60.0f);
+		}
+		best_ms = std::min(best_ms, elapsed_ms(start));
+
+		snow_free(&snow);
+	}
+
+	job_pool_stop(&pool);
+
+	f64 ns_per_flake = best_ms * 1e6 / ((f64)count * BENCH_FRAMES);
+	printf("  %u flakes, %u threads: %.3f ms/frame, %.2f ns/flake, %.1f KiB upload/frame\n",
+		count, threads, best_ms / BENCH_FRAMES, ns_per_flake, count * sizeof(f32) * 3 / 1024.0);
+}
+
+void bench_cover(u32 covers_x, u32 covers_z) {
+	u32 num_covers = covers_x * covers_z;
+	BenchCover *covers = (BenchCover *)malloc(sizeof(BenchCover) * num_covers);
+	for (u32 i = 0; i < num_covers; i++) {
+		BenchCover *cover = &covers[i];
+		snow_cover_init(cover, (i % covers_x) * BenchCover::width, (i / covers_x) * BenchCover::depth);
+		for (u32 r = 0; r < BenchCover::depth; r++) {
+			for (u32 c = 0; c < BenchCover::width; c++) {
+				cover->top[r][c] = ceilf(terrain_height(cover->x + c, cover->z + r));
+			}
+		}
+		cover->dirty_rows = 0;
+	}
+
+	SnowClock clock;
+	bzero(&clock, sizeof(SnowClock));
+
+	u64 ns = 0;
+	u64 upload_bytes = 0;
+	for (u32 tick = 0; tick < BENCH_COVER_TICKS; tick++) {
+		ns += snow_cover_update(covers, num_covers, &clock, 1.0f / SNOW_COVER_TICK_HZ);
+
+		// What upload_cover_snow() would send
+		for (u32 i = 0; i < num_covers; i++) {
+			upload_bytes += snow_cover_flush(&covers[i], [](u32, u32) {});
+		}
+	}
+
+	u64 snow = 0;
+	for (u32 i = 0; i < num_covers; i++) {
+		for (u32 r = 0; r < BenchCover::depth; r++) {
+			for (u32 c = 0; c < BenchCover::width; c++) {
+				snow += covers[i].snow[r][c];
+			}
+		}
+	}
+
+	printf("  %ux%u columns: %.2f us/tick, %.1f KiB upload/tick of %.1f KiB, mean depth %.2f blocks after %.0fs\n",
+		covers_x * BenchCover::width, covers_z * BenchCover::depth, ns / 1000.0 / BENCH_COVER_TICKS, upload_bytes / 1024.0 / BENCH_COVER_TICKS,
+		sizeof(covers[0].snow) * num_covers / 1024.0, (f64)snow / SNOW_COVER_STEPS / (num_covers * BenchCover::width * BenchCover::depth),
+		(f64)BENCH_COVER_TICKS / SNOW_COVER_TICK_HZ);
+
+	free(covers);
+}
+
+int main() {
+	metrics_init();
+
+	SurfaceMap surface;
+	surface.origin_x = 0;
+	surface.origin_z = 0;
+	surface.size_x = BENCH_WIDTH;
+	surface.size_z = BENCH_WIDTH;
+	surface.heights = (f32 *)malloc(sizeof(f32) * BENCH_WIDTH * BENCH_WIDTH);
+	for (u32 x = 0; x < BENCH_WIDTH; x++) {
+		for (u32 z = 0; z < BENCH_WIDTH; z++) {
+			surface.heights[COMPRESS_TWO(x, z, BENCH_WIDTH)] = ceilf(terrain_height(x, z));
+		}
+	}
+
+	u32 cores = std::max(std::thread::hardware_concurrency(), 1u);
+	u32 counts[] = { 200000, 1000000 };
+
+	printf("snow\n");
+	for (u32 i = 0; i < ARRAY_SIZE(counts); i++) {
+		for (u32 threads = 1; threads <= cores; threads *= 2) {
+			bench_flakes(&surface, counts[i], threads);
+		}
+		if ((cores & (cores - 1)) != 0) {
+			bench_flakes(&surface, counts[i], cores);
+		}
+	}
+
+	printf("snow cover, %u Hz\n", SNOW_COVER_TICK_HZ);
+	bench_cover(6, 6);
+	bench_cover(32, 32);
+
+	free(surface.heights);
+	return 0;
+}
@@ -0,0 +1,199 @@
+#ifndef SNOW_COVER_H
+#define SNOW_COVER_H
+
+#include <float.h>
+
+#include "common.h"
+#include "chunk.h"
+#include "metrics.h"
+
+// Snow lying on the terrain, one depth byte per world column, kept per chunk
+// column beside the surface height it rests on. Blocks and meshes are never
+// touched: the renderer draws each covered column as a thin slab on top of its
+// SIDE_TOP face, and only the rows of a cover that changed are re-uploaded.
+
+// Depth is counted in 1/SNOW_COVER_STEPS of a block
+#define SNOW_COVER_STEPS 16
+#define SNOW_COVER_MAX_DEPTH 12
+
+// The precipitation model runs at a fixed rate, however fast frames are drawn
+#define SNOW_COVER_TICK_HZ 20
+#define SNOW_COVER_MAX_TICKS 8
+
+// Columns of each cover that may receive a flake per tick, picked at random
+#define SNOW_COVER_RANDOM_TICKS 16
+
+// A column this many steps above a neighbour's snow sheds onto it instead
+#define SNOW_COVER_SLIDE_STEPS 2
+
+template <u32 W, u32 D>
+struct SnowCover {
+	static_assert(D <= 64, "dirty rows are tracked in a 64 bit mask");
+
+	static const u32 width = W;
+	static const u32 depth = D;
+
+	u8 snow[D][W];
+
+	// Height of the top face the snow rests on, -FLT_MAX where there's no ground loaded
+	f32 top[D][W];
+
+	// World position of column [0][0]
+	i64 x;
+	i64 z;
+
+	// Bit r is set when row r changed since the last upload
+	u64 dirty_rows;
+
+	u32 rng;
+};
+
+template <typename S>
+void snow_cover_init(S *cover, i64 x, i64 z) {
+	bzero(cover->snow, sizeof(cover->snow));
+	for (u32 r = 0; r < S::depth; r++) {
+		for (u32 c = 0; c < S::width; c++) {
+			cover->top[r][c] = -FLT_MAX;
+		}
+	}
+
+	cover->x = x;
+	cover->z = z;
+	cover->dirty_rows = S::depth == 64 ? ~0ull : (1ull << S::depth) - 1;
+	cover->rng = ((u32)(x * 73856093) ^ (u32)(z * 19349663) ^ 0x2545f491) | 1;
+}
+
+// Calls upload(first_row, num_rows) for each run of dirty rows and clears them.
+// Returns the bytes passed to upload.
+template <typename S, typename F>
+u64 snow_cover_flush(S *cover, F upload) {
+	u64 bytes = 0;
+	u64 rows = cover->dirty_rows;
+	while (rows != 0) {
+		u32 first = __builtin_ctzll(rows);
+		u64 clean = ~(rows >> first);
+		u32 count = clean == 0 ? 64 - first : __builtin_ctzll(clean);
+		if (first + count > S::depth) {
+			count = S::depth - first;
+		}
+
+		upload(first, count);
+		bytes += count * sizeof(cover->snow[0]);
+		rows &= count == 64 ? 0 : ~(((1ull << count) - 1) << first);
+	}
+	cover->dirty_rows = 0;
+	return bytes;
+}
+
+// Snowfall intensity in [0, 1] over a cover, a slowly drifting storm
+f32 snow_intensity(i64 x, i64 z, f32 time) {
+	f32 n = stb_perlin_noise3(x / 160.0f + time * 0.02f, z / 160.0f, time * 0.01f, 0, 0, 0);
+	f32 intensity = 0.6f + n;
+	return intensity < 0.1f ? 0.1f : (intensity > 1.0f ? 1.0f : intensity);
+}
+
+// Snow level of a column in steps above the world origin, for sliding
+template <typename S>
+f32 snow_cover_level(S *cover, u32 r, u32 c) {
+	return cover->top[r][c] * SNOW_COVER_STEPS + cover->snow[r][c];
+}
+
+// One precipitation tick: a few random columns of the cover each catch a flake
+// with the storm's probability. A flake landing on a pile that stands well above
+// a neighbour slides down onto it, so the cover stays smooth. Returns the
+// number of columns that changed.
+template <typename S>
+u32 snow_cover_tick(S *cover, f32 time) {
+	f32 intensity = snow_intensity(cover->x + S::width / 2, cover->z + S::depth / 2, time);
+	u32 threshold = (u32)(intensity * 65536.0f);
+	u32 changed = 0;
+
+	for (u32 i = 0; i < SNOW_COVER_RANDOM_TICKS; i++) {
+		u32 x = cover->rng;
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		cover->rng = x;
+
+		if ((x >> 16) >= threshold) {
+			continue;
+		}
+
+		u32 r = (x >> 8) % S::depth;
+		u32 c = x % S::width;
+		if (cover->top[r][c] == -FLT_MAX) {
+			continue;
+		}
+
+		f32 level = snow_cover_level(cover, r, c);
+		u32 best_r = r;
+		u32 best_c = c;
+		f32 best_level = level - SNOW_COVER_SLIDE_STEPS;
+
+		const i32 offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+		for (u32 n = 0; n < 4; n++) {
+			i32 nr = (i32)r + offsets[n][0];
+			i32 nc = (i32)c + offsets[n][1];
+			if (nr < 0 || nc < 0 || nr >= (i32)S::depth || nc >= (i32)S::width || cover->top[nr][nc] == -FLT_MAX) {
+				continue;
+			}
+			f32 n_level = snow_cover_level(cover, nr, nc);
+			if (n_level < best_level && cover->snow[nr][nc] < SNOW_COVER_MAX_DEPTH) {
+				best_r = nr;
+				best_c = nc;
+				best_level = n_level;
+			}
+		}
+
+		if (cover->snow[best_r][best_c] >= SNOW_COVER_MAX_DEPTH) {
+			continue;
+		}
+
+		cover->snow[best_r][best_c]++;
+		cover->dirty_rows |= 1ull << best_r;
+		changed++;
+	}
+
+	return changed;
+}
+
+typedef struct SnowClock {
+	// Fraction of a tick carried over to the next frame
+	f32 pending;
+	f32 time;
+	u32 ticks;
+} SnowClock;
+
+// Runs every tick that dt completes over all covers in one batch, capped so a
+// long stall doesn't turn into a burst. Returns the time taken in ns.
+template <typename S>
+u64 snow_cover_update(S *covers, u32 num_covers, SnowClock *clock, f32 dt) {
+	clock->pending += dt * SNOW_COVER_TICK_HZ;
+	u32 ticks = (u32)clock->pending;
+	clock->pending -= ticks;
+	if (ticks > SNOW_COVER_MAX_TICKS) {
+		ticks = SNOW_COVER_MAX_TICKS;
+	}
+	clock->ticks = ticks;
+	if (ticks == 0) {
+		return 0;
+	}
+
+	u64 start = metrics_now_ns();
+
+	u32 changed = 0;
+	for (u32 t = 0; t < ticks; t++) {
+		clock->time += 1.0f / SNOW_COVER_TICK_HZ;
+		for (u32 i = 0; i < num_covers; i++) {
+			changed += snow_cover_tick(&covers[i], clock->time);
+		}
+	}
+
+	u64 elapsed = metrics_now_ns() - start;
+	counter_add(&metrics.snow_cover_ticks, ticks);
+	counter_add(&metrics.snow_cover_changes, changed);
+	histogram_observe(&metrics.snow_cover_time, elapsed / ticks);
+	return elapsed;
+}
+
+#endif
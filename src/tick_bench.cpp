@@ -0,0 +1,134 @@
+#include <chrono>
+#include <algorithm>
+
+#define STB_PERLIN_IMPLEMENTATION
+#include "chunk.h"
+#include "ticks.h"
+
+// Headless block ticks over a generated region with snow dropped from the sky
+// across chunk borders, on 1..N threads. Chunks are coloured the same way on
+// any thread count and every tick is deterministic, so the world hash printed
+// for each run must match.
+
+#define BENCH_CHUNKS_X 8
+#define BENCH_CHUNKS_Y 6
+#define BENCH_CHUNKS_Z 8
+#define BENCH_MIN_C_Y -1
+#define BENCH_TICKS 400
+
+f64 elapsed_ms(std::chrono::high_resolution_clock::time_point start) {
+	std::chrono::duration<f64, std::milli> d = std::chrono::high_resolution_clock::now() - start;
+	return d.count();
+}
+
+// FNV-1a over every block in the grid
+u64 world_hash(Chunk **chunks, u32 count) {
+	u64 hash = 14695981039346656037ull;
+	for (u32 i = 0; i < count; i++) {
+		for (u32 x = 0; x <= Chunk::width + 1; x++) {
+			for (u32 y = 0; y <= Chunk::height + 1; y++) {
+				for (u32 z = 0; z <= Chunk::depth + 1; z++) {
+					hash = (hash ^ chunk_block(chunks[i], x, y, z)) * 1099511628211ull;
+				}
+			}
+		}
+	}
+	return hash;
+}
+
+void bench_ticks(u32 threads) {
+	u32 count = BENCH_CHUNKS_X * BENCH_CHUNKS_Y * BENCH_CHUNKS_Z;
+	Chunk **chunks = (Chunk **)malloc(sizeof(Chunk *) * count);
+
+	ChunkColumn<Chunk> column;
+	for (u32 x = 0; x < BENCH_CHUNKS_X; x++) {
+		for (u32 z = 0; z < BENCH_CHUNKS_Z; z++) {
+			generate_column(&column, x, z);
+			for (u32 y = 0; y < BENCH_CHUNKS_Y; y++) {
+				Chunk *chunk = generate_chunk(&column, BENCH_MIN_C_Y + y);
+				generate_mesh(chunk, NULL);
+				chunks[COMPRESS_THREE(x, y, z, BENCH_CHUNKS_X, BENCH_CHUNKS_Y)] = chunk;
+			}
+		}
+	}
+
+	JobPool pool;
+	job_pool_start(&pool, threads - 1);
+
+	BlockTicker<Chunk> ticker;
+	block_ticker_init(&ticker, chunks, BENCH_CHUNKS_X, BENCH_CHUNKS_Y, BENCH_CHUNKS_Z, &pool);
+
+	// Hang a snow block in the sky every few columns, high enough to fall through a chunk border
+	u32 dropped = 0;
+	for (u32 i = 0; i < count; i++) {
+		Chunk *chunk = chunks[i];
+		if (chunk->blocks != NULL || chunk->fill || chunk->y_off < TERRAIN_AVG_HEIGHT) {
+			continue;
+		}
+
+		chunk_materialize(chunk);
+		for (u32 x = 1; x <= Chunk::width; x += 5) {
+			for (u32 z = 1; z <= Chunk::depth; z += 5) {
+				chunk->blocks[x][Chunk::height / 2][z] = BLOCK_SNOW;
+				chunk_schedule(chunk, x, Chunk::height / 2, z, 1);
+				dropped++;
+			}
+		}
+	}
+
+	u64 changed = 0;
+	u64 remeshed = 0;
+	u64 chunks_ticked = 0;
+	u64 chunk_ns = 0;
+	f64 tick_ms = 0.0;
+	f64 remesh_ms = 0.0;
+	f64 worst_ms = 0.0;
+
+	for (u32 t = 0; t < BENCH_TICKS; t++) {
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		block_ticker_update(&ticker, 1.0f / TICK_HZ);
+		f64 ms = elapsed_ms(start);
+		tick_ms += ms;
+		worst_ms = std::max(worst_ms, ms);
+
+		start = std::chrono::high_resolution_clock::now();
+		block_ticker_remesh(&ticker);
+		remesh_ms += elapsed_ms(start);
+
+		changed += ticker.blocks_changed;
+		remeshed += ticker.num_remesh;
+		chunks_ticked += ticker.chunks_ticked;
+		chunk_ns += ticker.chunk_ns;
+	}
+
+	printf("  %u threads: %.3f ms/tick (%.3f worst), %.2f us/chunk, %.1f blocks changed/tick, %.1f remeshes/tick at %.3f ms/tick, hash %016llx\n",
+		threads, tick_ms / BENCH_TICKS, worst_ms, chunks_ticked ? chunk_ns / 1000.0 / chunks_ticked : 0.0, (f64)changed / BENCH_TICKS,
+		(f64)remeshed / BENCH_TICKS, remesh_ms / BENCH_TICKS, (unsigned long long)world_hash(chunks, count));
+
+	if (threads == 1) {
+		printf("  (%u chunks, %u snow blocks dropped)\n", count, dropped);
+	}
+
+	block_ticker_free(&ticker);
+	job_pool_stop(&pool);
+
+	for (u32 i = 0; i < count; i++) {
+		free_chunk(chunks[i]);
+	}
+	free(chunks);
+}
+
+int main() {
+	metrics_init();
+
+	u32 cores = std::max(std::thread::hardware_concurrency(), 1u);
+
+	printf("block ticks, %u ticks at %u Hz\n", BENCH_TICKS, TICK_HZ);
+	for (u32 threads = 1; threads <= cores; threads *= 2) {
+		bench_ticks(threads);
+	}
+	if ((cores & (cores - 1)) != 0) {
+		bench_ticks(cores);
+	}
+	return 0;
+}
@@ -0,0 +1,563 @@
+#ifndef TICKS_H
+#define TICKS_H
+
+#include <atomic>
+
+#include "common.h"
+#include "chunk.h"
+#include "jobs.h"
+#include "metrics.h"
+#include "budget.h"
+
+// Block updates over a grid of loaded chunks. Each tick runs every chunk's due
+// scheduled ticks plus a few random ones, the chunks in parallel.
+//
+// A block update reads and writes at most one block away, so it touches its own
+// chunk and the 26 around it. Chunks are split into 27 colours by their grid
+// position mod 3 on each axis; chunks of one colour are 3 apart, their
+// neighbourhoods never overlap, and each colour runs as one parallel pass.
+// Updates read and write the chunk that owns a block, never a border copy, and
+// the copies in neighbouring chunks are refreshed once the whole tick is done.
+// Chunks whose blocks the memory budget evicted don't tick and are read through
+// their neighbours' border copies, until a write or a scheduled tick brings them back.
+
+#define TICK_HZ 20
+#define TICK_MAX_PER_FRAME 8
+
+#define TICK_RANDOM_PER_CHUNK 32
+
+// Ticks before a block without support drops one step, or water flows
+#define TICK_FALL_DELAY 2
+#define TICK_FLOW_DELAY 4
+
+// Exposed snow below this world height melts
+#define TICK_MELT_HEIGHT TERRAIN_AVG_HEIGHT
+
+#define TICK_COLOURS 27
+
+// A block changed by the current tick, by grid index of the chunk that owns it
+typedef struct ChangedBlock {
+	u32 chunk;
+	u16 x;
+	u16 y;
+	u16 z;
+} ChangedBlock;
+
+typedef struct ChangeList {
+	ChangedBlock *items;
+	u32 size;
+	u32 capacity;
+} ChangeList;
+
+template <typename C>
+struct BlockTicker {
+	// Laid out as COMPRESS_THREE(x, y, z, nx, ny), chunks may be swapped between ticks
+	C **chunks;
+	u32 nx;
+	u32 ny;
+	u32 nz;
+
+	JobPool *pool;
+
+	u64 tick;
+	f32 pending;
+
+	// Per chunk, only written by the pass that owns the chunk's neighbourhood
+	u8 *dirty;
+	ChangeList *changes;
+
+	// Chunks to remesh after the last update, in grid indices
+	u32 *remesh;
+	u32 num_remesh;
+
+	// Totals of the last update
+	u32 ticks_run;
+	std::atomic<u64> blocks_changed;
+	std::atomic<u64> chunks_ticked;
+	std::atomic<u64> chunk_ns;
+};
+
+template <typename C>
+struct TickContext {
+	BlockTicker<C> *ticker;
+	u32 index;
+	i32 gx;
+	i32 gy;
+	i32 gz;
+	u32 rng;
+	u32 changed;
+};
+
+template <typename C>
+void block_ticker_init(BlockTicker<C> *ticker, C **chunks, u32 nx, u32 ny, u32 nz, JobPool *pool) {
+	u32 count = nx * ny * nz;
+
+	ticker->chunks = chunks;
+	ticker->nx = nx;
+	ticker->ny = ny;
+	ticker->nz = nz;
+	ticker->pool = pool;
+	ticker->tick = 0;
+	ticker->pending = 0.0f;
+	ticker->dirty = (u8 *)calloc(count, sizeof(u8));
+	ticker->changes = (ChangeList *)calloc(count, sizeof(ChangeList));
+	ticker->remesh = (u32 *)malloc(count * sizeof(u32));
+	ticker->num_remesh = 0;
+	ticker->ticks_run = 0;
+	ticker->blocks_changed = 0;
+	ticker->chunks_ticked = 0;
+	ticker->chunk_ns = 0;
+}
+
+template <typename C>
+void block_ticker_free(BlockTicker<C> *ticker) {
+	for (u32 i = 0; i < ticker->nx * ticker->ny * ticker->nz; i++) {
+		free(ticker->changes[i].items);
+	}
+	free(ticker->changes);
+	free(ticker->dirty);
+	free(ticker->remesh);
+}
+
+u32 tick_rand(u32 *state) {
+	u32 x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+// Gives a uniform or evicted section real block data so single blocks can be changed
+template <typename C>
+void chunk_materialize(C *chunk) {
+	chunk_restore_blocks(chunk);
+	chunk->pristine = false;
+	if (chunk->blocks != NULL) {
+		return;
+	}
+
+	chunk_alloc_blocks(chunk);
+	if (chunk->fill) {
+		for (u32 x = 0; x <= C::width + 1; x++) {
+			for (u32 y = 0; y <= C::height + 1; y++) {
+				u8 block = block_for_height(chunk->y_off + y);
+				for (u32 z = 0; z <= C::depth + 1; z++) {
+					chunk->blocks[x][y][z] = block;
+				}
+			}
+		}
+	}
+}
+
+template <typename C>
+void chunk_schedule(C *chunk, u16 x, u16 y, u16 z, u64 due) {
+	if (chunk->num_ticks == chunk->ticks_capacity) {
+		chunk->ticks_capacity = chunk->ticks_capacity ? chunk->ticks_capacity * 2 : 64;
+		chunk->ticks = (ScheduledTick *)realloc(chunk->ticks, chunk->ticks_capacity * sizeof(ScheduledTick));
+	}
+
+	ScheduledTick *tick = &chunk->ticks[chunk->num_ticks++];
+	tick->due = due;
+	tick->x = x;
+	tick->y = y;
+	tick->z = z;
+}
+
+void change_list_push(ChangeList *list, u32 chunk, u16 x, u16 y, u16 z) {
+	if (list->size == list->capacity) {
+		list->capacity = list->capacity ? list->capacity * 2 : 64;
+		list->items = (ChangedBlock *)realloc(list->items, list->capacity * sizeof(ChangedBlock));
+	}
+
+	ChangedBlock *change = &list->items[list->size++];
+	change->chunk = chunk;
+	change->x = x;
+	change->y = y;
+	change->z = z;
+}
+
+// Resolves block index x, y, z of the context's chunk, which may be one outside
+// it, to the chunk that owns it. Returns false outside the loaded grid.
+template <typename C>
+bool tick_locate(TickContext<C> *ctx, i32 *x, i32 *y, i32 *z, u32 *index) {
+	i32 gx = ctx->gx;
+	i32 gy = ctx->gy;
+	i32 gz = ctx->gz;
+
+	if (*x == 0) {
+		gx--;
+		*x = C::width;
+	} else if (*x == (i32)C::width + 1) {
+		gx++;
+		*x = 1;
+	}
+	if (*y == 0) {
+		gy--;
+		*y = C::height;
+	} else if (*y == (i32)C::height + 1) {
+		gy++;
+		*y = 1;
+	}
+	if (*z == 0) {
+		gz--;
+		*z = C::depth;
+	} else if (*z == (i32)C::depth + 1) {
+		gz++;
+		*z = 1;
+	}
+
+	BlockTicker<C> *ticker = ctx->ticker;
+	if (gx < 0 || gy < 0 || gz < 0 || gx >= (i32)ticker->nx || gy >= (i32)ticker->ny || gz >= (i32)ticker->nz) {
+		return false;
+	}
+
+	*index = COMPRESS_THREE(gx, gy, gz, ticker->nx, ticker->ny);
+	return true;
+}
+
+template <typename C>
+u8 tick_get(TickContext<C> *ctx, i32 x, i32 y, i32 z) {
+	i32 lx = x, ly = y, lz = z;
+	u32 index;
+	if (!tick_locate(ctx, &lx, &ly, &lz, &index) || ctx->ticker->chunks[index]->evicted != BLOCKS_RESIDENT) {
+		// Nothing outside the grid or in a frozen chunk changes, so the border copy is current
+		return chunk_block(ctx->ticker->chunks[ctx->index], x, y, z);
+	}
+	return chunk_block(ctx->ticker->chunks[index], lx, ly, lz);
+}
+
+template <typename C>
+void tick_set(TickContext<C> *ctx, i32 x, i32 y, i32 z, u8 block) {
+	u32 index;
+	if (!tick_locate(ctx, &x, &y, &z, &index)) {
+		return;
+	}
+
+	C *chunk = ctx->ticker->chunks[index];
+	chunk_materialize(chunk);
+	chunk->blocks[x][y][z] = block;
+
+	ctx->ticker->dirty[index] = 1;
+	change_list_push(&ctx->ticker->changes[ctx->index], index, x, y, z);
+	ctx->changed++;
+}
+
+template <typename C>
+void tick_schedule(TickContext<C> *ctx, i32 x, i32 y, i32 z, u32 delay) {
+	u32 index;
+	if (!tick_locate(ctx, &x, &y, &z, &index)) {
+		return;
+	}
+	chunk_schedule(ctx->ticker->chunks[index], x, y, z, ctx->ticker->tick + delay);
+}
+
+// Wakes the falling and flowing blocks around one that just changed, except
+// the one at skip_x, skip_y, skip_z which is already scheduled
+template <typename C>
+void tick_wake_neighbors(TickContext<C> *ctx, i32 x, i32 y, i32 z, i32 skip_x, i32 skip_y, i32 skip_z) {
+	const i32 offsets[6][3] = { { 0, 1, 0 }, { 0, -1, 0 }, { 1, 0, 0 }, { -1, 0, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+	for (u32 i = 0; i < 6; i++) {
+		i32 nx = x + offsets[i][0];
+		i32 ny = y + offsets[i][1];
+		i32 nz = z + offsets[i][2];
+		if (nx == skip_x && ny == skip_y && nz == skip_z) {
+			continue;
+		}
+
+		u8 block = tick_get(ctx, nx, ny, nz);
+		if (block == BLOCK_SNOW || block == BLOCK_WATER) {
+			tick_schedule(ctx, nx, ny, nz, 1);
+		}
+	}
+}
+
+// Moves the block at x, y, z one step, leaving what was at the destination behind
+template <typename C>
+void tick_move(TickContext<C> *ctx, i32 x, i32 y, i32 z, i32 to_x, i32 to_y, i32 to_z, u32 delay) {
+	u8 block = tick_get(ctx, x, y, z);
+	u8 displaced = tick_get(ctx, to_x, to_y, to_z);
+
+	tick_set(ctx, to_x, to_y, to_z, block);
+	tick_set(ctx, x, y, z, displaced);
+	tick_schedule(ctx, to_x, to_y, to_z, delay);
+	if (displaced != BLOCK_AIR) {
+		tick_schedule(ctx, x, y, z, delay);
+	}
+	tick_wake_neighbors(ctx, x, y, z, to_x, to_y, to_z);
+}
+
+// Block behaviour. x, y, z is inside the context's chunk; scheduled is false
+// for a random tick.
+//   snow   falls through air and water, melts into water when exposed below TICK_MELT_HEIGHT
+//   water  falls through air, spills off ledges and evaporates in the open
+//   dirt   grows grass when a grass block is next to it and nothing is on top
+template <typename C>
+void tick_block(TickContext<C> *ctx, i32 x, i32 y, i32 z, bool scheduled) {
+	u8 block = tick_get(ctx, x, y, z);
+	u8 below = tick_get(ctx, x, y - 1, z);
+	u8 above = tick_get(ctx, x, y + 1, z);
+	i64 world_y = ctx->ticker->chunks[ctx->index]->y_off + y;
+
+	switch (block) {
+		case BLOCK_SNOW: {
+			if (below == BLOCK_AIR || below == BLOCK_WATER) {
+				if (scheduled) {
+					tick_move(ctx, x, y, z, x, y - 1, z, TICK_FALL_DELAY);
+				} else {
+					tick_schedule(ctx, x, y, z, TICK_FALL_DELAY);
+				}
+			} else if (!scheduled && above == BLOCK_AIR && world_y < TICK_MELT_HEIGHT) {
+				tick_set(ctx, x, y, z, BLOCK_WATER);
+				tick_schedule(ctx, x, y, z, TICK_FLOW_DELAY);
+			}
+		} break;
+		case BLOCK_WATER: {
+			if (below == BLOCK_AIR) {
+				if (scheduled) {
+					tick_move(ctx, x, y, z, x, y - 1, z, TICK_FALL_DELAY);
+				} else {
+					tick_schedule(ctx, x, y, z, TICK_FALL_DELAY);
+				}
+			} else if (scheduled) {
+				// Spill towards one random side if the ground drops away there
+				const i32 sides[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+				u32 side = tick_rand(&ctx->rng) % 4;
+				i32 sx = x + sides[side][0];
+				i32 sz = z + sides[side][1];
+				if (tick_get(ctx, sx, y, sz) == BLOCK_AIR && tick_get(ctx, sx, y - 1, sz) == BLOCK_AIR) {
+					tick_move(ctx, x, y, z, sx, y, sz, TICK_FLOW_DELAY);
+				}
+			} else if (above == BLOCK_AIR && (tick_rand(&ctx->rng) % 4) == 0) {
+				tick_set(ctx, x, y, z, BLOCK_AIR);
+				tick_wake_neighbors(ctx, x, y, z, x, y, z);
+			}
+		} break;
+		case BLOCK_DIRT: {
+			if (scheduled || above != BLOCK_AIR) {
+				break;
+			}
+
+			const i32 sides[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+			for (u32 i = 0; i < 4; i++) {
+				for (i32 dy = -1; dy <= 1; dy++) {
+					if (tick_get(ctx, x + sides[i][0], y + dy, z + sides[i][1]) == BLOCK_GRASS) {
+						tick_set(ctx, x, y, z, BLOCK_GRASS);
+						return;
+					}
+				}
+			}
+		} break;
+	}
+}
+
+// Due scheduled ticks first, then the random ones. Runs inside a colour pass.
+template <typename C>
+void tick_chunk(BlockTicker<C> *ticker, u32 index, i32 gx, i32 gy, i32 gz) {
+	C *chunk = ticker->chunks[index];
+	if (chunk->blocks == NULL) {
+		// Uniform and frozen chunks only have their scheduled ticks to run
+		bool any_due = false;
+		for (u32 i = 0; i < chunk->num_ticks && !any_due; i++) {
+			any_due = chunk->ticks[i].due <= ticker->tick;
+		}
+		if (!any_due) {
+			return;
+		}
+	}
+	chunk_restore_blocks(chunk);
+
+	u64 start = metrics_now_ns();
+
+	TickContext<C> ctx;
+	ctx.ticker = ticker;
+	ctx.index = index;
+	ctx.gx = gx;
+	ctx.gy = gy;
+	ctx.gz = gz;
+	ctx.rng = ((u32)(ticker->tick * 0x9e3779b9u) ^ (index * 0x85ebca6bu)) | 1;
+	ctx.changed = 0;
+
+	// Take the due ticks off the list first, running them can schedule more
+	thread_local ScheduledTick *due = NULL;
+	thread_local u32 due_capacity = 0;
+	if (due_capacity < chunk->num_ticks) {
+		due_capacity = chunk->num_ticks;
+		due = (ScheduledTick *)realloc(due, due_capacity * sizeof(ScheduledTick));
+	}
+
+	u32 num_due = 0;
+	u32 kept = 0;
+	for (u32 i = 0; i < chunk->num_ticks; i++) {
+		if (chunk->ticks[i].due <= ticker->tick) {
+			due[num_due++] = chunk->ticks[i];
+		} else {
+			chunk->ticks[kept++] = chunk->ticks[i];
+		}
+	}
+	chunk->num_ticks = kept;
+
+	for (u32 i = 0; i < num_due; i++) {
+		tick_block(&ctx, due[i].x, due[i].y, due[i].z, true);
+	}
+
+	if (chunk->blocks != NULL) {
+		for (u32 i = 0; i < TICK_RANDOM_PER_CHUNK; i++) {
+			u32 r = tick_rand(&ctx.rng);
+			tick_block(&ctx, 1 + r % C::width, 1 + (r >> 10) % C::height, 1 + (r >> 20) % C::depth, false);
+		}
+	}
+
+	ticker->blocks_changed += ctx.changed;
+	ticker->chunks_ticked++;
+
+	u64 elapsed = metrics_now_ns() - start;
+	ticker->chunk_ns += elapsed;
+	histogram_observe(&metrics.block_tick_chunk_time, elapsed);
+}
+
+// Copies a changed block into the border of every neighbouring chunk that mirrors it
+template <typename C>
+void tick_sync_borders(BlockTicker<C> *ticker, ChangedBlock *change) {
+	i32 gx = change->chunk % ticker->nx;
+	i32 gy = (change->chunk / ticker->nx) % ticker->ny;
+	i32 gz = change->chunk / (ticker->nx * ticker->ny);
+	u8 block = ticker->chunks[change->chunk]->blocks[change->x][change->y][change->z];
+
+	// Per axis: the chunk offset and block index of each copy, the owner's own first
+	i32 copies[3][2][2];
+	u32 num_copies[3];
+	u32 pos[3] = { change->x, change->y, change->z };
+	u32 dims[3] = { C::width, C::height, C::depth };
+	for (u32 a = 0; a < 3; a++) {
+		copies[a][0][0] = 0;
+		copies[a][0][1] = pos[a];
+		num_copies[a] = 1;
+		if (pos[a] == 1) {
+			copies[a][num_copies[a]][0] = -1;
+			copies[a][num_copies[a]++][1] = dims[a] + 1;
+		} else if (pos[a] == dims[a]) {
+			copies[a][num_copies[a]][0] = 1;
+			copies[a][num_copies[a]++][1] = 0;
+		}
+	}
+
+	for (u32 i = 0; i < num_copies[0]; i++) {
+		for (u32 j = 0; j < num_copies[1]; j++) {
+			for (u32 k = 0; k < num_copies[2]; k++) {
+				if (i == 0 && j == 0 && k == 0) {
+					continue;
+				}
+
+				i32 nx = gx + copies[0][i][0];
+				i32 ny = gy + copies[1][j][0];
+				i32 nz = gz + copies[2][k][0];
+				if (nx < 0 || ny < 0 || nz < 0 || nx >= (i32)ticker->nx || ny >= (i32)ticker->ny || nz >= (i32)ticker->nz) {
+					continue;
+				}
+
+				u32 index = COMPRESS_THREE(nx, ny, nz, ticker->nx, ticker->ny);
+				C *chunk = ticker->chunks[index];
+				i32 x = copies[0][i][1];
+				i32 y = copies[1][j][1];
+				i32 z = copies[2][k][1];
+				// A frozen neighbour only comes back when its copy is out of date
+				if (chunk_peek_block(chunk, x, y, z) == block) {
+					continue;
+				}
+
+				chunk_materialize(chunk);
+				chunk->blocks[x][y][z] = block;
+				ticker->dirty[index] = 1;
+			}
+		}
+	}
+}
+
+// One tick over the whole grid: 27 parallel colour passes, then the border
+// copies of every changed block are brought up to date
+template <typename C>
+void block_ticker_step(BlockTicker<C> *ticker) {
+	ticker->tick++;
+
+	for (u32 colour = 0; colour < TICK_COLOURS; colour++) {
+		u32 cx = colour % 3;
+		u32 cy = (colour / 3) % 3;
+		u32 cz = colour / 9;
+
+		// Chunks of this colour along each axis
+		u32 nx = ticker->nx > cx ? (ticker->nx - cx + 2) / 3 : 0;
+		u32 ny = ticker->ny > cy ? (ticker->ny - cy + 2) / 3 : 0;
+		u32 nz = ticker->nz > cz ? (ticker->nz - cz + 2) / 3 : 0;
+
+		job_pool_run(ticker->pool, nx * ny * nz, [=](u32 task) {
+			i32 gx = cx + 3 * (task % nx);
+			i32 gy = cy + 3 * ((task / nx) % ny);
+			i32 gz = cz + 3 * (task / (nx * ny));
+			tick_chunk(ticker, COMPRESS_THREE(gx, gy, gz, ticker->nx, ticker->ny), gx, gy, gz);
+		});
+	}
+
+	for (u32 i = 0; i < ticker->nx * ticker->ny * ticker->nz; i++) {
+		ChangeList *list = &ticker->changes[i];
+		for (u32 c = 0; c < list->size; c++) {
+			tick_sync_borders(ticker, &list->items[c]);
+		}
+		list->size = 0;
+	}
+}
+
+// Runs every tick that dt completes, capped so a stall doesn't turn into a burst,
+// and collects the chunks they changed into ticker->remesh. Returns the time taken in ns.
+template <typename C>
+u64 block_ticker_update(BlockTicker<C> *ticker, f32 dt) {
+	ticker->pending += dt * TICK_HZ;
+	u32 ticks = (u32)ticker->pending;
+	ticker->pending -= ticks;
+	if (ticks > TICK_MAX_PER_FRAME) {
+		ticks = TICK_MAX_PER_FRAME;
+	}
+
+	ticker->ticks_run = ticks;
+	ticker->blocks_changed = 0;
+	ticker->chunks_ticked = 0;
+	ticker->chunk_ns = 0;
+	ticker->num_remesh = 0;
+	if (ticks == 0) {
+		return 0;
+	}
+
+	u64 start = metrics_now_ns();
+	for (u32 t = 0; t < ticks; t++) {
+		u64 tick_start = metrics_now_ns();
+		block_ticker_step(ticker);
+		histogram_observe(&metrics.block_tick_time, metrics_now_ns() - tick_start);
+	}
+
+	u32 count = ticker->nx * ticker->ny * ticker->nz;
+	u64 pending = 0;
+	for (u32 i = 0; i < count; i++) {
+		if (ticker->dirty[i]) {
+			ticker->remesh[ticker->num_remesh++] = i;
+			ticker->dirty[i] = 0;
+		}
+		pending += ticker->chunks[i]->num_ticks;
+	}
+
+	counter_add(&metrics.block_ticks, ticks);
+	counter_add(&metrics.blocks_changed, ticker->blocks_changed);
+	counter_add(&metrics.remesh_requests, ticker->num_remesh);
+	gauge_set(&metrics.scheduled_ticks, pending);
+
+	return metrics_now_ns() - start;
+}
+
+// Remeshes the chunks of the last update's remesh requests in parallel
+template <typename C>
+void block_ticker_remesh(BlockTicker<C> *ticker) {
+	job_pool_run(ticker->pool, ticker->num_remesh, [=](u32 i) {
+		generate_mesh(ticker->chunks[ticker->remesh[i]], NULL);
+	});
+}
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef WORLD_FILE_H
+#define WORLD_FILE_H
+
+#include "common.h"
+#include "chunk.h"
+
+// Pre-generated worlds are stored one file per chunk column, holding every
+// section in a vertical range with its blocks (run length encoded) and mesh.
+// An offset table lets a single section be read without the rest of the column.
+// Files are written to a temporary name and renamed, so one that exists is complete.
+
+#define WORLD_FILE_MAGIC 0x4c4f434e574f4e53ull // "SNOWCOLL"
+#define WORLD_FILE_VERSION 2
+
+typedef struct ColumnHeader {
+	u64 magic;
+	u32 version;
+	u32 seed;
+	u16 width;
+	u16 height;
+	u16 depth;
+	u16 num_sections;
+	i64 c_x;
+	i64 c_z;
+	i64 min_c_y;
+} ColumnHeader;
+
+typedef struct SectionHeader {
+	u8 fill;
+	u8 has_blocks;
+	u16 pad;
+	u32 rle_size;
+	u32 mesh_size;
+	u32 bucket_start[FACE_DIRECTIONS + 1];
+} SectionHeader;
+
+void column_path(char *out, u32 out_size, const char *dir, i64 c_x, i64 c_z) {
+	snprintf(out, out_size, "%s/c.%lld.%lld.col", dir, (long long)c_x, (long long)c_z);
+}
+
+// (run, value) byte pairs, runs are 1-255 long
+u32 rle_encode(u8 *in, u32 in_size, u8 *out) {
+	u32 out_size = 0;
+	u32 i = 0;
+	while (i < in_size) {
+		u8 value = in[i];
+		u32 run = 1;
+		while (i + run < in_size && in[i + run] == value && run < 255) {
+			run++;
+		}
+
+		out[out_size++] = run;
+		out[out_size++] = value;
+		i += run;
+	}
+	return out_size;
+}
+
+bool rle_decode(u8 *in, u32 in_size, u8 *out, u32 out_size) {
+	u32 o = 0;
+	for (u32 i = 0; i + 1 < in_size; i += 2) {
+		u8 run = in[i];
+		if (o + run > out_size) {
+			return false;
+		}
+		memset(out + o, in[i + 1], run);
+		o += run;
+	}
+	return o == out_size;
+}
+
+template <typename C>
+bool column_header_matches(ColumnHeader *header, i64 c_x, i64 c_z) {
+	return header->magic == WORLD_FILE_MAGIC && header->version == WORLD_FILE_VERSION && header->seed == world_seed
+		&& header->width == C::width && header->height == C::height && header->depth == C::depth
+		&& header->c_x == c_x && header->c_z == c_z;
+}
+
+// True when a complete file for this column, seed and chunk size covering
+// [min_c_y, min_c_y + num_sections) already exists
+template <typename C>
+bool column_file_done(const char *dir, i64 c_x, i64 c_z, i64 min_c_y, u32 num_sections) {
+	char path[1024];
+	column_path(path, sizeof(path), dir, c_x, c_z);
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		return false;
+	}
+
+	ColumnHeader header;
+	bool done = fread(&header, sizeof(header), 1, file) == 1 && column_header_matches<C>(&header, c_x, c_z)
+		&& header.min_c_y <= min_c_y && header.min_c_y + header.num_sections >= min_c_y + num_sections;
+
+	fclose(file);
+	return done;
+}
+
+// Writes sections[0..num_sections), which must be consecutive from min_c_y. Returns bytes written, 0 on failure.
+template <typename C>
+u64 write_column(const char *dir, i64 c_x, i64 c_z, i64 min_c_y, C **sections, u32 num_sections) {
+	char path[1024];
+	char tmp_path[1024 + 8];
+	column_path(path, sizeof(path), dir, c_x, c_z);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	FILE *file = fopen(tmp_path, "wb");
+	if (file == NULL) {
+		printf("Couldn't open %s!\n", tmp_path);
+		return 0;
+	}
+
+	ColumnHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = WORLD_FILE_MAGIC;
+	header.version = WORLD_FILE_VERSION;
+	header.seed = world_seed;
+	header.width = C::width;
+	header.height = C::height;
+	header.depth = C::depth;
+	header.num_sections = num_sections;
+	header.c_x = c_x;
+	header.c_z = c_z;
+	header.min_c_y = min_c_y;
+
+	u64 *offsets = (u64 *)malloc(sizeof(u64) * num_sections);
+	u32 block_bytes = sizeof(typename C::Slice) * (C::width + 2);
+	u8 *rle = (u8 *)malloc(block_bytes * 2);
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(offsets, sizeof(u64), num_sections, file);
+
+	for (u32 i = 0; i < num_sections; i++) {
+		C *chunk = sections[i];
+		offsets[i] = ftell(file);
+
+		SectionHeader section;
+		memset(&section, 0, sizeof(section));
+		section.fill = chunk->fill;
+		section.has_blocks = chunk->blocks != NULL;
+		section.rle_size = chunk->blocks ? rle_encode((u8 *)chunk->blocks, block_bytes, rle) : 0;
+		section.mesh_size = chunk->mesh_size;
+		memcpy(section.bucket_start, chunk->bucket_start, sizeof(section.bucket_start));
+
+		fwrite(&section, sizeof(section), 1, file);
+		fwrite(rle, 1, section.rle_size, file);
+		fwrite(chunk->mesh, sizeof(Vertex), section.mesh_size, file);
+	}
+
+	u64 total = ftell(file);
+
+	fseek(file, sizeof(header), SEEK_SET);
+	fwrite(offsets, sizeof(u64), num_sections, file);
+
+	bool ok = ferror(file) == 0;
+	ok = (fclose(file) == 0) && ok;
+
+	free(offsets);
+	free(rle);
+
+	if (!ok || rename(tmp_path, path) != 0) {
+		printf("Couldn't write %s!\n", path);
+		remove(tmp_path);
+		return 0;
+	}
+
+	return total;
+}
+
+// Loads section c_y of a pre-generated column, mesh included.
+// Returns NULL when there is no file for it, so the caller can generate it instead.
+template <typename C>
+C *read_section(const char *dir, i64 c_x, i64 c_y, i64 c_z) {
+	char path[1024];
+	column_path(path, sizeof(path), dir, c_x, c_z);
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		return NULL;
+	}
+
+	ColumnHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || !column_header_matches<C>(&header, c_x, c_z)
+		|| c_y < header.min_c_y || c_y >= header.min_c_y + header.num_sections) {
+		fclose(file);
+		return NULL;
+	}
+
+	u64 offset = 0;
+	SectionHeader section;
+	fseek(file, sizeof(header) + sizeof(u64) * (c_y - header.min_c_y), SEEK_SET);
+	if (fread(&offset, sizeof(u64), 1, file) != 1 || fseek(file, offset, SEEK_SET) != 0 || fread(&section, sizeof(section), 1, file) != 1) {
+		fclose(file);
+		return NULL;
+	}
+
+	// Baked sections are generated ones, so evicting them can drop their blocks
+	C *chunk = new_chunk<C>(c_x, c_y, c_z);
+	chunk->fill = section.fill;
+	chunk->pristine = true;
+	memcpy(chunk->bucket_start, section.bucket_start, sizeof(chunk->bucket_start));
+
+	bool ok = true;
+	if (section.has_blocks) {
+		u32 block_bytes = sizeof(typename C::Slice) * (C::width + 2);
+		u8 *rle = (u8 *)malloc(section.rle_size);
+
+		chunk_alloc_blocks(chunk);
+		ok = fread(rle, 1, section.rle_size, file) == section.rle_size && rle_decode(rle, section.rle_size, (u8 *)chunk->blocks, block_bytes);
+		free(rle);
+	}
+
+	if (ok && section.mesh_size > 0) {
+		chunk->mesh = (Vertex *)malloc(section.mesh_size * sizeof(Vertex));
+		chunk->mesh_size = section.mesh_size;
+		counter_add(&metrics.allocations, 1);
+		gauge_add(&metrics.mesh_bytes, section.mesh_size * sizeof(Vertex));
+
+		ok = fread(chunk->mesh, sizeof(Vertex), section.mesh_size, file) == section.mesh_size;
+	}
+
+	fclose(file);
+
+	if (!ok) {
+		printf("%s is corrupt, regenerating section %lld\n", path, (long long)c_y);
+		free_chunk(chunk);
+		return NULL;
+	}
+
+	return chunk;
+}
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef WORLD_RENDER_H
+#define WORLD_RENDER_H
+
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "chunk.h"
+#include "metrics.h"
+#include "occlusion.h"
+
+// Draws the world's chunk meshes out of one vertex buffer, shared by the viewer
+// and render_bench. The world's program, vertex layout and uniforms are set up
+// by the caller.
+
+// Camera speed of the scripted benchmark flight, radians of the circle per frame
+#define BENCH_ORBIT_SPEED 0.01f
+
+// What the world's draw calls did, summed over frames
+typedef struct DrawStats {
+	u64 buckets_skipped;
+	u64 vertices_drawn;
+	u64 vertices_culled;
+} DrawStats;
+
+// count chunks and where each one's mesh starts in the vertex buffer. Chunks
+// with on_gpu[i] unset have no room in it and aren't drawn.
+typedef struct WorldDraw {
+	u32 count;
+	Chunk **chunks;
+	u32 *draw_first;
+	bool *on_gpu;
+
+	// Per chunk scratch for draw_world()
+	u32 *order;
+	f32 *distance;
+	bool *hidden;
+	bool *tested;
+} WorldDraw;
+
+void world_draw_init(WorldDraw *draw, u32 count, Chunk **chunks, u32 *draw_first, bool *on_gpu) {
+	draw->count = count;
+	draw->chunks = chunks;
+	draw->draw_first = draw_first;
+	draw->on_gpu = on_gpu;
+
+	draw->order = (u32 *)malloc(sizeof(u32) * count);
+	draw->distance = (f32 *)malloc(sizeof(f32) * count);
+	draw->hidden = (bool *)malloc(sizeof(bool) * count);
+	draw->tested = (bool *)malloc(sizeof(bool) * count);
+}
+
+void world_draw_free(WorldDraw *draw) {
+	free(draw->order);
+	free(draw->distance);
+	free(draw->hidden);
+	free(draw->tested);
+}
+
+void chunk_bounds(Chunk *chunk, glm::vec3 *min, glm::vec3 *max) {
+	*min = glm::vec3(chunk->x_off + 1, chunk->y_off + 1, chunk->z_off + 1);
+	*max = *min + glm::vec3(Chunk::width, Chunk::height, Chunk::depth);
+}
+
+// Bit d is set when faces of direction d in the chunk can point towards the camera.
+// A face is only visible from the side its normal points to, so e.g. once the
+// camera is below the lowest top face in the chunk none of its top faces can be seen.
+u32 visible_buckets(Chunk *chunk, glm::vec3 cam_pos) {
+	glm::vec3 min, max;
+	chunk_bounds(chunk, &min, &max);
+
+	u32 visible = 0;
+	if (cam_pos.y > min.y + 1) {
+		visible |= 1 << FACE_TOP;
+	}
+	if (cam_pos.y < max.y - 1) {
+		visible |= 1 << FACE_BOTTOM;
+	}
+	if (cam_pos.x < max.x - 1) {
+		visible |= 1 << FACE_LEFT;
+	}
+	if (cam_pos.x > min.x + 1) {
+		visible |= 1 << FACE_RIGHT;
+	}
+	if (cam_pos.z > min.z + 1) {
+		visible |= 1 << FACE_FRONT;
+	}
+	if (cam_pos.z < max.z - 1) {
+		visible |= 1 << FACE_BACK;
+	}
+	return visible;
+}
+
+// Draws the chunk's visible direction buckets, merging neighbouring ones into a
+// single draw. Returns the vertices submitted.
+u32 draw_chunk(WorldDraw *draw, u32 i, glm::vec3 cam_pos, DrawStats *stats) {
+	Chunk *chunk = draw->chunks[i];
+	u32 visible = visible_buckets(chunk, cam_pos);
+	u32 submitted = 0;
+
+	u32 d = 0;
+	while (d < FACE_DIRECTIONS) {
+		if (!(visible & (1 << d))) {
+			u32 culled = chunk->bucket_start[d + 1] - chunk->bucket_start[d];
+			if (culled > 0) {
+				stats->buckets_skipped++;
+				stats->vertices_culled += culled;
+				counter_add(&metrics.buckets_skipped, 1);
+			}
+			d++;
+			continue;
+		}
+
+		u32 start = d;
+		while (d < FACE_DIRECTIONS && (visible & (1 << d))) {
+			d++;
+		}
+
+		u32 first = chunk->bucket_start[start];
+		u32 count = chunk->bucket_start[d] - first;
+		if (count > 0) {
+			glDrawArrays(GL_TRIANGLES, draw->draw_first[i] + first, count);
+			stats->vertices_drawn += count;
+			counter_add(&metrics.vertices_submitted, count);
+			submitted += count;
+		}
+	}
+	return submitted;
+}
+
+// Draws the chunks nearest first, so the depth test rejects what's behind them
+// before it's shaded. With occlusion culling the chunks hidden in earlier
+// frames wait until every box was tested against the rest, then are drawn only
+// if theirs showed. program and vao are the world's, bound again after the boxes.
+void draw_world(WorldDraw *draw, OcclusionCuller *culler, bool occluding, GLuint program, GLuint vao, glm::mat4 pv, glm::vec3 cam_pos, DrawStats *stats) {
+	u32 *order = draw->order;
+	f32 *distance = draw->distance;
+	bool *hidden = draw->hidden;
+	bool *tested = draw->tested;
+
+	occlusion_collect(culler);
+
+	u32 count = 0;
+	for (u32 i = 0; i < draw->count; i++) {
+		Chunk *chunk = draw->chunks[i];
+		if (chunk->mesh_size == 0 || !draw->on_gpu[i]) {
+			continue;
+		}
+
+		glm::vec3 min, max;
+		chunk_bounds(chunk, &min, &max);
+		glm::vec3 to_center = (min + max) * 0.5f - cam_pos;
+		distance[i] = glm::dot(to_center, to_center);
+		hidden[i] = occluding && occlusion_hidden(culler, i);
+		order[count++] = i;
+	}
+
+	// Without culling chunks go in slot order, as a baseline for the pixels drawn
+	if (occluding) {
+		std::sort(order, order + count, [&](u32 a, u32 b) { return distance[a] < distance[b]; });
+	}
+
+	bool counting = occlusion_begin_samples(culler, SAMPLES_VISIBLE);
+	for (u32 n = 0; n < count; n++) {
+		if (!hidden[order[n]]) {
+			draw_chunk(draw, order[n], cam_pos, stats);
+		}
+	}
+	if (counting) {
+		occlusion_end_samples();
+	}
+
+	if (!occluding) {
+		return;
+	}
+
+	occlusion_begin_boxes(culler, pv);
+	for (u32 n = 0; n < count; n++) {
+		glm::vec3 min, max;
+		chunk_bounds(draw->chunks[order[n]], &min, &max);
+		tested[order[n]] = occlusion_test_box(culler, order[n], min, max, cam_pos);
+	}
+	occlusion_end_boxes();
+
+	glUseProgram(program);
+	glBindVertexArray(vao);
+
+	counting = occlusion_begin_samples(culler, SAMPLES_HIDDEN);
+	for (u32 n = 0; n < count; n++) {
+		u32 i = order[n];
+		if (!hidden[i]) {
+			continue;
+		}
+
+		// Without a query this frame there's nothing to go by, so it's drawn
+		if (!tested[i]) {
+			draw_chunk(draw, i, cam_pos, stats);
+			continue;
+		}
+
+		occlusion_begin_conditional(culler, i);
+		u32 vertices = draw_chunk(draw, i, cam_pos, stats);
+		occlusion_end_conditional(culler, i, vertices);
+	}
+	if (counting) {
+		occlusion_end_samples();
+	}
+}
+
+// Deterministic flight for SNOW_BENCH_FRAMES: circles the loaded area while
+// bobbing up and down far enough to stream vertical layers in and out,
+// over a view_width wide world
+void bench_camera(u32 bench_frame, u32 view_width, glm::vec3 *cam_pos, glm::vec3 *cam_front) {
+	f32 t = bench_frame * BENCH_ORBIT_SPEED;
+	f32 center = view_width / 2.0f;
+	f32 radius = center * 0.6f;
+
+	*cam_pos = glm::vec3(center + cosf(t) * radius, 80.0f + sinf(t * 3.0f) * 48.0f, center + sinf(t) * radius);
+	*cam_front = glm::normalize(glm::vec3(-sinf(t), -0.35f, cosf(t)));
+}
+
+#endif
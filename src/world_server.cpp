@@ -0,0 +1,112 @@
+#include <thread>
+
+#include <signal.h>
+
+#define STB_PERLIN_IMPLEMENTATION
+#include "chunk.h"
+#include "world_server.h"
+
+// Headless world server: owns the world and streams its sections to any number
+// of viewers on one machine, see world_server.h. Sections are generated and
+// meshed on all cores, or read from a pregen bake when one is given.
+
+#define SERVER_POLL_MS 100
+#define SERVER_REPORT_MS 5000
+
+volatile sig_atomic_t server_running = 1;
+
+void server_stop_signal(int) {
+	server_running = 0;
+}
+
+void usage() {
+	printf("usage: world_server [-seed N] [-threads N] [-world DIR] [-max-sections N] [-metrics SOCKET] SOCKET\n");
+	printf("  -world         serve sections baked by pregen from DIR, generating the rest\n");
+	printf("  -max-sections  sections kept loaded, more only while viewers hold them; 0 for no cap (default %u)\n", WORLD_SERVER_MAX_SECTIONS);
+	printf("  -metrics       serve Prometheus metrics on another Unix socket\n");
+}
+
+int main(int argc, char **argv) {
+	u32 threads = std::thread::hardware_concurrency();
+	const char *baked_dir = NULL;
+	const char *metrics_socket = NULL;
+	const char *socket_path = NULL;
+	u32 max_sections = WORLD_SERVER_MAX_SECTIONS;
+
+	for (i32 i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+			world_seed = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+			threads = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-world") == 0 && i + 1 < argc) {
+			baked_dir = argv[++i];
+		} else if (strcmp(argv[i], "-max-sections") == 0 && i + 1 < argc) {
+			max_sections = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-metrics") == 0 && i + 1 < argc) {
+			metrics_socket = argv[++i];
+		} else if (argv[i][0] != '-' && socket_path == NULL) {
+			socket_path = argv[i];
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	if (socket_path == NULL) {
+		usage();
+		return 1;
+	}
+	if (threads == 0) {
+		threads = 1;
+	}
+
+	metrics_init();
+	metrics_start_exporter(metrics_socket, NULL, SERVER_POLL_MS);
+
+	signal(SIGINT, server_stop_signal);
+	signal(SIGTERM, server_stop_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	JobPool pool;
+	job_pool_start(&pool, threads - 1);
+
+	WorldServer<Chunk> server;
+	if (!world_server_start(&server, socket_path, baked_dir, &pool)) {
+		job_pool_stop(&pool);
+		return 1;
+	}
+	server.max_sections = max_sections;
+
+	printf("seed %u, %ux%ux%u sections, %u threads, serving %s%s%s\n", world_seed, CHUNK_WIDTH, CHUNK_HEIGHT, CHUNK_DEPTH, threads, socket_path,
+		baked_dir ? " from " : "", baked_dir ? baked_dir : "");
+
+	u64 next_report = metrics_now_ns() + (u64)SERVER_REPORT_MS * 1000000;
+	u64 last_sections = 0;
+	u64 last_bytes = 0;
+	while (server_running) {
+		world_server_poll(&server, SERVER_POLL_MS);
+
+		if (metrics_now_ns() < next_report) {
+			continue;
+		}
+		next_report += (u64)SERVER_REPORT_MS * 1000000;
+
+		u64 sections = metrics.server_sections_sent.value;
+		u64 bytes = metrics.server_bytes_sent.value;
+		if (sections != last_sections || bytes != last_bytes) {
+			printf("%u viewers, %llu sections resident, %.1f sections/s, %.1f MiB/s, %lld queued\n", (u32)server.clients.size(),
+				(unsigned long long)server.sections.size(), (sections - last_sections) * 1000.0 / SERVER_REPORT_MS,
+				(bytes - last_bytes) / (1024.0 * 1024.0) * 1000.0 / SERVER_REPORT_MS, (long long)metrics.server_pending.value);
+		}
+		last_sections = sections;
+		last_bytes = bytes;
+	}
+
+	printf("sent %llu sections and %llu deltas, %.1f MiB for %.1f MiB in memory\n", (unsigned long long)metrics.server_sections_sent.value,
+		(unsigned long long)metrics.server_deltas_sent.value, metrics.server_bytes_sent.value / (1024.0 * 1024.0), metrics.server_raw_bytes.value / (1024.0 * 1024.0));
+
+	world_server_stop(&server);
+	job_pool_stop(&pool);
+	metrics_stop_exporter();
+	return 0;
+}
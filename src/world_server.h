@@ -0,0 +1,1242 @@
+#ifndef WORLD_SERVER_H
+#define WORLD_SERVER_H
+
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "common.h"
+#include "chunk.h"
+#include "jobs.h"
+#include "metrics.h"
+#include "ticks.h"
+#include "world_file.h"
+
+// A world server owns the chunk sections and serves them to viewers over a Unix
+// socket, so generation and meshing never stall a viewer's frame and several
+// viewers can share one world. Every message is a MessageHeader and a payload.
+// Viewers send their position, the sections they want and the ones they let go
+// of, and block edits. The server answers with whole sections, blocks run length
+// encoded and meshes in chunk-local bytes, and with deltas of the blocks an edit
+// changed plus the new mesh for sections a viewer already holds. Requests wait in
+// a queue per viewer and the ones nearest to the viewer are served first.
+
+#define WORLD_PROTOCOL_MAGIC 0x574f4e53 // "SNOW"
+#define WORLD_PROTOCOL_VERSION 1
+
+// A message claiming to be larger than this drops the connection
+#define WORLD_MAX_MESSAGE (16 << 20)
+
+// Sections taken off a viewer's queue per server loop, and how many bytes may sit
+// unsent for it before it gets no more. Keeping the backlog short lets a viewer
+// that moved have its new nearest sections served next.
+#define WORLD_SERVER_BATCH 64
+#define WORLD_SERVER_WINDOW (1 << 20)
+
+#define WORLD_SERVER_READ_SIZE 65536
+
+// A viewer asking for more sections than this at once drops the connection. The
+// biggest viewer area holds a few thousand.
+#define WORLD_SERVER_MAX_PENDING 65536
+
+// Sections the server keeps loaded by default. Past it, sections no viewer holds
+// or wants are freed down to 7/8 of it, farthest from every viewer first, and
+// generated again if asked for. Edited ones always stay.
+#define WORLD_SERVER_MAX_SECTIONS 8192
+
+enum {
+	MSG_HELLO,
+	MSG_VIEWER,
+	MSG_REQUEST,
+	MSG_DROP,
+	MSG_EDIT,
+	MSG_SECTION,
+	MSG_DELTA,
+};
+
+typedef struct MessageHeader {
+	u32 type;
+	u32 size;
+} MessageHeader;
+
+// Sent by both ends first. The viewer takes the server's seed; chunk dimensions must match.
+typedef struct HelloMessage {
+	u32 magic;
+	u32 version;
+	u32 seed;
+	u16 width;
+	u16 height;
+	u16 depth;
+	u16 pad;
+} HelloMessage;
+
+// MSG_REQUEST and MSG_DROP carry SectionPos[size / sizeof(SectionPos)]
+typedef struct SectionPos {
+	i32 c_x;
+	i32 c_y;
+	i32 c_z;
+} SectionPos;
+
+typedef struct ViewerMessage {
+	f32 x;
+	f32 y;
+	f32 z;
+} ViewerMessage;
+
+// MSG_EDIT carries BlockEdit[size / sizeof(BlockEdit)], in world block positions
+typedef struct BlockEdit {
+	i32 x;
+	i32 y;
+	i32 z;
+	u8 block;
+	u8 pad[3];
+} BlockEdit;
+
+// MSG_SECTION: this, rle_size bytes of rle_encode()d blocks, then mesh_size WireVertex
+typedef struct SectionMessage {
+	SectionPos pos;
+	u8 fill;
+	u8 has_blocks;
+	u16 pad;
+	u32 rle_size;
+	u32 mesh_size;
+	u32 bucket_start[FACE_DIRECTIONS + 1];
+} SectionMessage;
+
+// MSG_DELTA: this, num_changes BlockChange, then for each face direction a
+// MeshSplice followed by its added WireVertex
+typedef struct DeltaMessage {
+	SectionPos pos;
+	u32 num_changes;
+	u32 mesh_size;
+} DeltaMessage;
+
+// Index into the section's block array, border included, in the low 24 bits and the block in the high 8
+typedef u32 BlockChange;
+
+// A face bucket of the new mesh is the old one with removed vertices after the
+// first keep replaced by added new ones. Faces are meshed in block order and an
+// edit only changes the ones around it, so most of every bucket is kept.
+typedef struct MeshSplice {
+	u32 keep;
+	u32 removed;
+	u32 added;
+} MeshSplice;
+
+// Mesh corners are whole block positions within the section, so bytes relative to its offset are exact
+typedef struct WireVertex {
+	u8 x;
+	u8 y;
+	u8 z;
+	u8 t_point;
+	u8 tex_id;
+	u8 ao;
+} WireVertex;
+
+typedef struct ByteBuffer {
+	u8 *data;
+	u32 size;
+	u32 capacity;
+
+	// Bytes at the front already sent or parsed
+	u32 start;
+} ByteBuffer;
+
+// Makes room for n more bytes and returns where they go, the caller adds what it wrote to size
+u8 *byte_buffer_grow(ByteBuffer *buffer, u32 n) {
+	if (buffer->size + n > buffer->capacity) {
+		buffer->capacity = std::max(buffer->size + n, buffer->capacity * 2);
+		buffer->data = (u8 *)realloc(buffer->data, buffer->capacity);
+	}
+	return buffer->data + buffer->size;
+}
+
+void byte_buffer_append(ByteBuffer *buffer, const void *data, u32 n) {
+	memcpy(byte_buffer_grow(buffer, n), data, n);
+	buffer->size += n;
+}
+
+void byte_buffer_consume(ByteBuffer *buffer, u32 n) {
+	buffer->start += n;
+	if (buffer->start == buffer->size) {
+		buffer->start = 0;
+		buffer->size = 0;
+	} else if (buffer->start > buffer->capacity / 2) {
+		memmove(buffer->data, buffer->data + buffer->start, buffer->size - buffer->start);
+		buffer->size -= buffer->start;
+		buffer->start = 0;
+	}
+}
+
+u32 byte_buffer_pending(ByteBuffer *buffer) {
+	return buffer->size - buffer->start;
+}
+
+void byte_buffer_free(ByteBuffer *buffer) {
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->size = 0;
+	buffer->capacity = 0;
+	buffer->start = 0;
+}
+
+void message_append(ByteBuffer *out, u32 type, const void *payload, u32 size) {
+	MessageHeader header;
+	header.type = type;
+	header.size = size;
+	byte_buffer_append(out, &header, sizeof(header));
+	byte_buffer_append(out, payload, size);
+}
+
+// Calls handle(type, payload, size) for every complete message in the buffer and
+// consumes it. Payloads are unaligned. Returns false on a malformed stream.
+template <typename F>
+bool messages_parse(ByteBuffer *in, F handle) {
+	while (byte_buffer_pending(in) >= sizeof(MessageHeader)) {
+		MessageHeader header;
+		memcpy(&header, in->data + in->start, sizeof(header));
+		if (header.size > WORLD_MAX_MESSAGE) {
+			return false;
+		}
+		if (byte_buffer_pending(in) < sizeof(header) + header.size) {
+			break;
+		}
+
+		bool ok = handle(header.type, in->data + in->start + sizeof(header), header.size);
+		byte_buffer_consume(in, sizeof(header) + header.size);
+		if (!ok) {
+			return false;
+		}
+	}
+	return true;
+}
+
+HelloMessage hello_message() {
+	HelloMessage hello;
+	memset(&hello, 0, sizeof(hello));
+	hello.magic = WORLD_PROTOCOL_MAGIC;
+	hello.version = WORLD_PROTOCOL_VERSION;
+	hello.seed = world_seed;
+	hello.width = CHUNK_WIDTH;
+	hello.height = CHUNK_HEIGHT;
+	hello.depth = CHUNK_DEPTH;
+	return hello;
+}
+
+bool hello_matches(HelloMessage *hello) {
+	return hello->magic == WORLD_PROTOCOL_MAGIC && hello->version == WORLD_PROTOCOL_VERSION
+		&& hello->width == CHUNK_WIDTH && hello->height == CHUNK_HEIGHT && hello->depth == CHUNK_DEPTH;
+}
+
+u64 section_key(i64 c_x, i64 c_y, i64 c_z) {
+	return ((u64)(c_x & 0x1fffff) << 42) | ((u64)(c_y & 0x1fffff) << 21) | (u64)(c_z & 0x1fffff);
+}
+
+u64 section_key(SectionPos pos) {
+	return section_key(pos.c_x, pos.c_y, pos.c_z);
+}
+
+template <typename C>
+SectionPos chunk_section_pos(C *chunk) {
+	SectionPos pos;
+	pos.c_x = floor_div(chunk->x_off, C::width);
+	pos.c_y = floor_div(chunk->y_off, C::height);
+	pos.c_z = floor_div(chunk->z_off, C::depth);
+	return pos;
+}
+
+template <typename C>
+u32 chunk_block_bytes() {
+	return sizeof(typename C::Slice) * (C::width + 2);
+}
+
+// What a section takes in memory, the measure for how well the wire format compresses it
+template <typename C>
+u64 chunk_raw_bytes(C *chunk) {
+	return sizeof(SectionMessage) + (chunk->blocks ? chunk_block_bytes<C>() : 0) + chunk->mesh_size * sizeof(Vertex);
+}
+
+// Writes mesh[first..first + count) to out
+template <typename C>
+void mesh_to_wire(C *chunk, u32 first, u32 count, WireVertex *out) {
+	for (u32 i = 0; i < count; i++) {
+		Vertex *v = &chunk->mesh[first + i];
+		out[i].x = (u8)(v->point.x - chunk->x_off);
+		out[i].y = (u8)(v->point.y - chunk->y_off);
+		out[i].z = (u8)(v->point.z - chunk->z_off);
+		out[i].t_point = v->t_point;
+		out[i].tex_id = v->tex_id;
+		out[i].ao = v->ao;
+	}
+}
+
+template <typename C>
+Vertex vertex_from_wire(C *chunk, u8 *wire) {
+	WireVertex w;
+	memcpy(&w, wire, sizeof(w));
+
+	Vertex v;
+	v.point = glm::vec3(chunk->x_off + w.x, chunk->y_off + w.y, chunk->z_off + w.z);
+	v.t_point = w.t_point;
+	v.tex_id = w.tex_id;
+	v.ao = w.ao;
+	return v;
+}
+
+bool vertex_equal(Vertex *a, Vertex *b) {
+	return a->point == b->point && a->t_point == b->t_point && a->tex_id == b->tex_id && a->ao == b->ao;
+}
+
+// Swaps in a mesh of mesh_size vertices, keeping the memory metrics straight
+template <typename C>
+void chunk_replace_mesh(C *chunk, Vertex *mesh, u32 mesh_size) {
+	if (chunk->mesh != NULL) {
+		counter_add(&metrics.frees, 1);
+	}
+	if (mesh != NULL) {
+		counter_add(&metrics.allocations, 1);
+	}
+	gauge_add(&metrics.mesh_bytes, ((i64)mesh_size - (chunk->mesh ? chunk->mesh_size : 0)) * sizeof(Vertex));
+
+	free(chunk->mesh);
+	chunk->mesh = mesh;
+	chunk->mesh_size = mesh_size;
+}
+
+
+// Appends a MSG_SECTION holding the chunk's blocks and mesh
+template <typename C>
+void section_encode(ByteBuffer *out, C *chunk) {
+	static_assert(C::width + 2 <= 256 && C::height + 2 <= 256 && C::depth + 2 <= 256, "mesh corners are sent as bytes");
+
+	u32 block_bytes = chunk_block_bytes<C>();
+	u32 max_size = sizeof(MessageHeader) + sizeof(SectionMessage) + (chunk->blocks ? block_bytes * 2 : 0) + chunk->mesh_size * sizeof(WireVertex);
+	u8 *start = byte_buffer_grow(out, max_size);
+
+	SectionMessage section;
+	memset(&section, 0, sizeof(section));
+	section.pos = chunk_section_pos(chunk);
+	section.fill = chunk->fill;
+	section.has_blocks = chunk->blocks != NULL;
+	section.rle_size = chunk->blocks ? rle_encode((u8 *)chunk->blocks, block_bytes, start + sizeof(MessageHeader) + sizeof(section)) : 0;
+	section.mesh_size = chunk->mesh_size;
+	memcpy(section.bucket_start, chunk->bucket_start, sizeof(section.bucket_start));
+
+	u8 *mesh = start + sizeof(MessageHeader) + sizeof(section) + section.rle_size;
+	mesh_to_wire(chunk, 0, chunk->mesh_size, (WireVertex *)mesh);
+
+	MessageHeader header;
+	header.type = MSG_SECTION;
+	header.size = sizeof(section) + section.rle_size + section.mesh_size * sizeof(WireVertex);
+	memcpy(start, &header, sizeof(header));
+	memcpy(start + sizeof(header), &section, sizeof(section));
+	out->size += sizeof(header) + header.size;
+}
+
+// Builds a chunk from a MSG_SECTION payload, NULL when it's malformed
+template <typename C>
+C *section_decode(u8 *payload, u32 size) {
+	SectionMessage section;
+	if (size < sizeof(section)) {
+		return NULL;
+	}
+	memcpy(&section, payload, sizeof(section));
+	if (size != sizeof(section) + section.rle_size + (u64)section.mesh_size * sizeof(WireVertex)
+		|| section.bucket_start[FACE_DIRECTIONS] != section.mesh_size) {
+		return NULL;
+	}
+
+	C *chunk = new_chunk<C>(section.pos.c_x, section.pos.c_y, section.pos.c_z);
+	chunk->fill = section.fill;
+	memcpy(chunk->bucket_start, section.bucket_start, sizeof(chunk->bucket_start));
+
+	if (section.has_blocks) {
+		chunk_alloc_blocks(chunk);
+		if (!rle_decode(payload + sizeof(section), section.rle_size, (u8 *)chunk->blocks, chunk_block_bytes<C>())) {
+			free_chunk(chunk);
+			return NULL;
+		}
+	}
+
+	if (section.mesh_size > 0) {
+		u8 *wire = payload + sizeof(section) + section.rle_size;
+		Vertex *mesh = (Vertex *)malloc(section.mesh_size * sizeof(Vertex));
+		for (u32 i = 0; i < section.mesh_size; i++) {
+			mesh[i] = vertex_from_wire(chunk, wire + i * sizeof(WireVertex));
+		}
+		chunk_replace_mesh(chunk, mesh, section.mesh_size);
+	}
+	return chunk;
+}
+
+// Appends a MSG_DELTA of changes[0..num_changes) and how the chunk's mesh
+// differs from old_mesh, whose buckets started at old_bucket_start
+template <typename C>
+void delta_encode(ByteBuffer *out, C *chunk, BlockChange *changes, u32 num_changes, Vertex *old_mesh, u32 *old_bucket_start) {
+	u32 header_at = out->size;
+	MessageHeader header;
+	memset(&header, 0, sizeof(header));
+	byte_buffer_append(out, &header, sizeof(header));
+
+	DeltaMessage delta;
+	memset(&delta, 0, sizeof(delta));
+	delta.pos = chunk_section_pos(chunk);
+	delta.num_changes = num_changes;
+	delta.mesh_size = chunk->mesh_size;
+	byte_buffer_append(out, &delta, sizeof(delta));
+	byte_buffer_append(out, changes, num_changes * sizeof(BlockChange));
+
+	for (u32 d = 0; d < FACE_DIRECTIONS; d++) {
+		Vertex *old_bucket = old_mesh + old_bucket_start[d];
+		Vertex *new_bucket = chunk->mesh + chunk->bucket_start[d];
+		u32 old_size = old_bucket_start[d + 1] - old_bucket_start[d];
+		u32 new_size = chunk->bucket_start[d + 1] - chunk->bucket_start[d];
+
+		// Common prefix, then common suffix of what's left
+		u32 keep = 0;
+		while (keep < old_size && keep < new_size && vertex_equal(&old_bucket[keep], &new_bucket[keep])) {
+			keep++;
+		}
+		u32 tail = 0;
+		while (tail < old_size - keep && tail < new_size - keep && vertex_equal(&old_bucket[old_size - 1 - tail], &new_bucket[new_size - 1 - tail])) {
+			tail++;
+		}
+
+		MeshSplice splice;
+		splice.keep = keep;
+		splice.removed = old_size - keep - tail;
+		splice.added = new_size - keep - tail;
+		byte_buffer_append(out, &splice, sizeof(splice));
+
+		mesh_to_wire(chunk, chunk->bucket_start[d] + keep, splice.added, (WireVertex *)byte_buffer_grow(out, splice.added * sizeof(WireVertex)));
+		out->size += splice.added * sizeof(WireVertex);
+	}
+
+	header.type = MSG_DELTA;
+	header.size = out->size - header_at - sizeof(header);
+	memcpy(out->data + header_at, &header, sizeof(header));
+}
+
+// Position of the section a MSG_DELTA is for, so the viewer can find it
+bool delta_pos(u8 *payload, u32 size, SectionPos *pos) {
+	if (size < sizeof(DeltaMessage)) {
+		return false;
+	}
+	memcpy(pos, payload, sizeof(SectionPos));
+	return true;
+}
+
+template <typename C>
+bool delta_apply(C *chunk, u8 *payload, u32 size) {
+	DeltaMessage delta;
+	if (size < sizeof(delta)) {
+		return false;
+	}
+	memcpy(&delta, payload, sizeof(delta));
+	u64 read = sizeof(delta) + (u64)delta.num_changes * sizeof(BlockChange);
+	if (read > size) {
+		return false;
+	}
+
+	u32 block_bytes = chunk_block_bytes<C>();
+	for (u32 i = 0; i < delta.num_changes; i++) {
+		BlockChange change;
+		memcpy(&change, payload + sizeof(delta) + i * sizeof(BlockChange), sizeof(change));
+		u32 index = change & 0xffffff;
+		if (index >= block_bytes) {
+			return false;
+		}
+
+		chunk_materialize(chunk);
+		((u8 *)chunk->blocks)[index] = change >> 24;
+	}
+
+	Vertex *mesh = delta.mesh_size ? (Vertex *)malloc(delta.mesh_size * sizeof(Vertex)) : NULL;
+	u32 bucket_start[FACE_DIRECTIONS + 1];
+	u32 size_so_far = 0;
+	for (u32 d = 0; d < FACE_DIRECTIONS; d++) {
+		MeshSplice splice;
+		if (read + sizeof(splice) > size) {
+			free(mesh);
+			return false;
+		}
+		memcpy(&splice, payload + read, sizeof(splice));
+		read += sizeof(splice);
+
+		u32 old_first = chunk->bucket_start[d];
+		u32 old_size = chunk->bucket_start[d + 1] - old_first;
+		u64 new_size = (u64)old_size - splice.removed + splice.added;
+		if ((u64)splice.keep + splice.removed > old_size || read + (u64)splice.added * sizeof(WireVertex) > size || size_so_far + new_size > delta.mesh_size) {
+			free(mesh);
+			return false;
+		}
+
+		bucket_start[d] = size_so_far;
+		Vertex *out = mesh + size_so_far;
+		u32 tail = old_size - splice.keep - splice.removed;
+		memcpy(out, chunk->mesh + old_first, splice.keep * sizeof(Vertex));
+		for (u32 i = 0; i < splice.added; i++) {
+			out[splice.keep + i] = vertex_from_wire(chunk, payload + read + i * sizeof(WireVertex));
+		}
+		memcpy(out + splice.keep + splice.added, chunk->mesh + old_first + splice.keep + splice.removed, tail * sizeof(Vertex));
+
+		read += splice.added * sizeof(WireVertex);
+		size_so_far += new_size;
+	}
+	bucket_start[FACE_DIRECTIONS] = size_so_far;
+
+	if (read != size || size_so_far != delta.mesh_size) {
+		free(mesh);
+		return false;
+	}
+
+	chunk_replace_mesh(chunk, mesh, delta.mesh_size);
+	memcpy(chunk->bucket_start, bucket_start, sizeof(chunk->bucket_start));
+	return true;
+}
+
+i32 unix_socket(const char *socket_path, bool listening) {
+	i32 fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		printf("Couldn't create world socket!\n");
+		return -1;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+	if (listening) {
+		unlink(socket_path);
+		if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+			printf("Couldn't listen on world socket %s!\n", socket_path);
+			close(fd);
+			return -1;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	} else if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		printf("Couldn't connect to world server %s!\n", socket_path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// Reads everything waiting on a non-blocking socket. Returns false once the other end is gone.
+bool socket_read(i32 fd, ByteBuffer *in) {
+	for (;;) {
+		u8 *data = byte_buffer_grow(in, WORLD_SERVER_READ_SIZE);
+		ssize_t n = recv(fd, data, WORLD_SERVER_READ_SIZE, MSG_DONTWAIT);
+		if (n > 0) {
+			in->size += n;
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return true;
+		}
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		return false;
+	}
+}
+
+// Sends as much of out as the socket takes without blocking. Returns false once the other end is gone.
+bool socket_write(i32 fd, ByteBuffer *out, u64 *sent) {
+	while (byte_buffer_pending(out) > 0) {
+		ssize_t n = send(fd, out->data + out->start, byte_buffer_pending(out), MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n > 0) {
+			byte_buffer_consume(out, n);
+			*sent += n;
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return true;
+		}
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		return false;
+	}
+	return true;
+}
+
+typedef struct PendingSection {
+	SectionPos pos;
+	u64 requested;
+} PendingSection;
+
+typedef struct ServerClient {
+	i32 fd;
+	bool greeted;
+	bool closed;
+
+	ByteBuffer in;
+	ByteBuffer out;
+
+	ViewerMessage viewer;
+
+	// Requested and not yet sent, with their keys in queued, and sent and not yet dropped
+	std::vector<PendingSection> pending;
+	std::unordered_set<u64> queued;
+	std::unordered_set<u64> held;
+} ServerClient;
+
+template <typename C>
+struct WorldServer {
+	i32 listen_fd;
+	const char *socket_path;
+
+	// Sections are loaded from here when baked, may be NULL
+	const char *baked_dir;
+
+	JobPool *pool;
+
+	// Sections loaded, see WORLD_SERVER_MAX_SECTIONS. 0 for no cap.
+	std::unordered_map<u64, C *> sections;
+	u32 max_sections;
+
+	// Sections whose own blocks were edited. A neighbour generated later copies
+	// their edge blocks into its border instead of trusting the terrain.
+	std::unordered_set<u64> edited;
+
+	std::vector<ServerClient *> clients;
+
+	// Edits received since the last loop, applied together
+	std::vector<BlockEdit> edits;
+};
+
+template <typename C>
+bool world_server_start(WorldServer<C> *server, const char *socket_path, const char *baked_dir, JobPool *pool) {
+	server->socket_path = socket_path;
+	server->baked_dir = baked_dir;
+	server->pool = pool;
+	server->max_sections = WORLD_SERVER_MAX_SECTIONS;
+	server->listen_fd = unix_socket(socket_path, true);
+	return server->listen_fd >= 0;
+}
+
+void server_client_close(ServerClient *client) {
+	close(client->fd);
+	byte_buffer_free(&client->in);
+	byte_buffer_free(&client->out);
+	gauge_add(&metrics.server_pending, -(i64)client->pending.size());
+	gauge_add(&metrics.server_clients, -1);
+	delete client;
+}
+
+template <typename C>
+void world_server_stop(WorldServer<C> *server) {
+	for (u32 i = 0; i < server->clients.size(); i++) {
+		server_client_close(server->clients[i]);
+	}
+	server->clients.clear();
+
+	for (auto it = server->sections.begin(); it != server->sections.end(); ++it) {
+		free_chunk(it->second);
+	}
+	server->sections.clear();
+	server->edited.clear();
+
+	if (server->listen_fd >= 0) {
+		close(server->listen_fd);
+		unlink(server->socket_path);
+		server->listen_fd = -1;
+	}
+}
+
+template <typename C>
+C *server_section(WorldServer<C> *server, i64 c_x, i64 c_y, i64 c_z) {
+	auto it = server->sections.find(section_key(c_x, c_y, c_z));
+	return it == server->sections.end() ? NULL : it->second;
+}
+
+// Copies the edge blocks of edited neighbours into a new section's border.
+// Returns true when any of them differed from the generated terrain.
+template <typename C>
+bool server_copy_borders(WorldServer<C> *server, C *chunk, SectionPos pos) {
+	bool changed = false;
+	u32 dims[3] = { C::width, C::height, C::depth };
+
+	for (i32 dx = -1; dx <= 1; dx++) {
+		for (i32 dy = -1; dy <= 1; dy++) {
+			for (i32 dz = -1; dz <= 1; dz++) {
+				if ((dx == 0 && dy == 0 && dz == 0) || server->edited.count(section_key(pos.c_x + dx, pos.c_y + dy, pos.c_z + dz)) == 0) {
+					continue;
+				}
+				C *neighbor = server_section(server, pos.c_x + dx, pos.c_y + dy, pos.c_z + dz);
+
+				// Per axis, the range of our indices the neighbour owns and where they are in it
+				i32 d[3] = { dx, dy, dz };
+				u32 first[3], count[3], from[3];
+				for (u32 a = 0; a < 3; a++) {
+					first[a] = d[a] < 0 ? 0 : (d[a] > 0 ? dims[a] + 1 : 1);
+					count[a] = d[a] == 0 ? dims[a] : 1;
+					from[a] = d[a] < 0 ? dims[a] : 1;
+				}
+
+				for (u32 x = 0; x < count[0]; x++) {
+					for (u32 y = 0; y < count[1]; y++) {
+						for (u32 z = 0; z < count[2]; z++) {
+							u8 block = chunk_block(neighbor, from[0] + x, from[1] + y, from[2] + z);
+							if (chunk_block(chunk, first[0] + x, first[1] + y, first[2] + z) == block) {
+								continue;
+							}
+							chunk_materialize(chunk);
+							chunk->blocks[first[0] + x][first[1] + y][first[2] + z] = block;
+							changed = true;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	return changed;
+}
+
+// Makes sure every section in positions[0..count) is loaded, generating and
+// meshing the missing ones across the pool
+template <typename C>
+void server_load_sections(WorldServer<C> *server, SectionPos *positions, u32 count) {
+	std::vector<SectionPos> missing;
+	std::unordered_set<u64> seen;
+	for (u32 i = 0; i < count; i++) {
+		u64 key = section_key(positions[i]);
+		if (server->sections.count(key) == 0 && seen.insert(key).second) {
+			missing.push_back(positions[i]);
+		}
+	}
+	if (missing.empty()) {
+		return;
+	}
+
+	std::vector<C *> loaded(missing.size());
+	job_pool_run(server->pool, missing.size(), [&](u32 i) {
+		SectionPos pos = missing[i];
+		C *chunk = server->baked_dir ? read_section<C>(server->baked_dir, pos.c_x, pos.c_y, pos.c_z) : NULL;
+		if (chunk == NULL) {
+			chunk = generate_chunk<C>(pos.c_x, pos.c_y, pos.c_z);
+			generate_mesh(chunk, NULL);
+		}
+		loaded[i] = chunk;
+	});
+
+	std::vector<C *> remesh;
+	for (u32 i = 0; i < missing.size(); i++) {
+		if (!server->edited.empty() && server_copy_borders(server, loaded[i], missing[i])) {
+			remesh.push_back(loaded[i]);
+		}
+		server->sections[section_key(missing[i])] = loaded[i];
+	}
+
+	job_pool_run(server->pool, remesh.size(), [&](u32 i) {
+		generate_mesh(remesh[i], NULL);
+	});
+}
+
+// Applies the edits received this loop. Each changes its block in the owning
+// section and the border copies in loaded neighbours, every section touched is
+// remeshed once, and viewers holding one get a delta of its changed blocks.
+template <typename C>
+void server_apply_edits(WorldServer<C> *server) {
+	if (server->edits.empty()) {
+		return;
+	}
+
+	std::vector<SectionPos> owners;
+	for (u32 i = 0; i < server->edits.size(); i++) {
+		BlockEdit *edit = &server->edits[i];
+		SectionPos pos;
+		pos.c_x = floor_div((i64)edit->x - 1, C::width);
+		pos.c_y = floor_div((i64)edit->y - 1, C::height);
+		pos.c_z = floor_div((i64)edit->z - 1, C::depth);
+		owners.push_back(pos);
+	}
+	server_load_sections(server, owners.data(), owners.size());
+
+	std::unordered_map<u64, std::vector<BlockChange>> touched;
+	u32 dims[3] = { C::width, C::height, C::depth };
+
+	for (u32 i = 0; i < server->edits.size(); i++) {
+		BlockEdit *edit = &server->edits[i];
+		SectionPos owner = owners[i];
+		i32 c[3] = { owner.c_x, owner.c_y, owner.c_z };
+		u32 pos[3] = { (u32)(edit->x - owner.c_x * (i64)C::width), (u32)(edit->y - owner.c_y * (i64)C::height), (u32)(edit->z - owner.c_z * (i64)C::depth) };
+
+		// Per axis: the section offset and block index of each copy, the owner's own first
+		i32 copies[3][2][2];
+		u32 num_copies[3];
+		for (u32 a = 0; a < 3; a++) {
+			copies[a][0][0] = 0;
+			copies[a][0][1] = pos[a];
+			num_copies[a] = 1;
+			if (pos[a] == 1) {
+				copies[a][num_copies[a]][0] = -1;
+				copies[a][num_copies[a]++][1] = dims[a] + 1;
+			} else if (pos[a] == dims[a]) {
+				copies[a][num_copies[a]][0] = 1;
+				copies[a][num_copies[a]++][1] = 0;
+			}
+		}
+
+		for (u32 a = 0; a < num_copies[0]; a++) {
+			for (u32 b = 0; b < num_copies[1]; b++) {
+				for (u32 d = 0; d < num_copies[2]; d++) {
+					C *chunk = server_section(server, c[0] + copies[0][a][0], c[1] + copies[1][b][0], c[2] + copies[2][d][0]);
+					u32 x = copies[0][a][1];
+					u32 y = copies[1][b][1];
+					u32 z = copies[2][d][1];
+					if (chunk == NULL || chunk_block(chunk, x, y, z) == edit->block) {
+						continue;
+					}
+
+					chunk_materialize(chunk);
+					chunk->blocks[x][y][z] = edit->block;
+
+					u32 index = (x * (C::height + 2) + y) * (C::depth + 2) + z;
+					touched[section_key(chunk_section_pos(chunk))].push_back(index | (u32)edit->block << 24);
+				}
+			}
+		}
+
+		server->edited.insert(section_key(owner));
+	}
+
+	counter_add(&metrics.server_edits, server->edits.size());
+	server->edits.clear();
+
+	// The old meshes are kept so only the vertices that changed are sent
+	std::vector<C *> remesh;
+	std::vector<Vertex *> old_meshes;
+	std::vector<u32> old_bucket_starts;
+	for (auto it = touched.begin(); it != touched.end(); ++it) {
+		C *chunk = server->sections[it->first];
+		remesh.push_back(chunk);
+
+		Vertex *old_mesh = (Vertex *)malloc(chunk->mesh_size * sizeof(Vertex));
+		memcpy(old_mesh, chunk->mesh, chunk->mesh_size * sizeof(Vertex));
+		old_meshes.push_back(old_mesh);
+		old_bucket_starts.insert(old_bucket_starts.end(), chunk->bucket_start, chunk->bucket_start + FACE_DIRECTIONS + 1);
+	}
+	job_pool_run(server->pool, remesh.size(), [&](u32 i) {
+		generate_mesh(remesh[i], NULL);
+	});
+
+	ByteBuffer delta;
+	memset(&delta, 0, sizeof(delta));
+	u32 t = 0;
+	for (auto it = touched.begin(); it != touched.end(); ++it, t++) {
+		C *chunk = remesh[t];
+		delta.size = 0;
+		delta_encode(&delta, chunk, it->second.data(), it->second.size(), old_meshes[t], &old_bucket_starts[t * (FACE_DIRECTIONS + 1)]);
+		free(old_meshes[t]);
+
+		for (u32 i = 0; i < server->clients.size(); i++) {
+			ServerClient *client = server->clients[i];
+			if (client->held.count(it->first) == 0) {
+				continue;
+			}
+			byte_buffer_append(&client->out, delta.data, delta.size);
+			counter_add(&metrics.server_deltas_sent, 1);
+			counter_add(&metrics.server_raw_bytes, chunk_raw_bytes(chunk));
+		}
+	}
+	byte_buffer_free(&delta);
+}
+
+// Moves the nearest requests of every viewer with room in its send window onto
+// its send buffer, loading all of them together first
+template <typename C>
+void server_serve(WorldServer<C> *server) {
+	typedef struct Pick {
+		ServerClient *client;
+		PendingSection pending;
+		ByteBuffer message;
+	} Pick;
+	std::vector<Pick> picks;
+
+	for (u32 i = 0; i < server->clients.size(); i++) {
+		ServerClient *client = server->clients[i];
+		if (client->pending.empty() || byte_buffer_pending(&client->out) >= WORLD_SERVER_WINDOW) {
+			continue;
+		}
+
+		ViewerMessage v = client->viewer;
+		auto nearer = [=](const PendingSection &a, const PendingSection &b) {
+			f32 ax = (a.pos.c_x + 0.5f) * C::width - v.x, ay = (a.pos.c_y + 0.5f) * C::height - v.y, az = (a.pos.c_z + 0.5f) * C::depth - v.z;
+			f32 bx = (b.pos.c_x + 0.5f) * C::width - v.x, by = (b.pos.c_y + 0.5f) * C::height - v.y, bz = (b.pos.c_z + 0.5f) * C::depth - v.z;
+			return ax * ax + ay * ay + az * az < bx * bx + by * by + bz * bz;
+		};
+
+		u32 n = std::min((u32)client->pending.size(), (u32)WORLD_SERVER_BATCH);
+		std::partial_sort(client->pending.begin(), client->pending.begin() + n, client->pending.end(), nearer);
+		for (u32 p = 0; p < n; p++) {
+			Pick pick;
+			pick.client = client;
+			pick.pending = client->pending[p];
+			memset(&pick.message, 0, sizeof(pick.message));
+			picks.push_back(pick);
+			client->queued.erase(section_key(pick.pending.pos));
+		}
+		client->pending.erase(client->pending.begin(), client->pending.begin() + n);
+		gauge_add(&metrics.server_pending, -(i64)n);
+	}
+	if (picks.empty()) {
+		return;
+	}
+
+	std::vector<SectionPos> positions;
+	for (u32 i = 0; i < picks.size(); i++) {
+		positions.push_back(picks[i].pending.pos);
+	}
+	server_load_sections(server, positions.data(), positions.size());
+
+	std::vector<C *> chunks;
+	for (u32 i = 0; i < picks.size(); i++) {
+		chunks.push_back(server->sections[section_key(picks[i].pending.pos)]);
+	}
+	job_pool_run(server->pool, picks.size(), [&](u32 i) {
+		section_encode(&picks[i].message, chunks[i]);
+	});
+
+	u64 now = metrics_now_ns();
+	for (u32 i = 0; i < picks.size(); i++) {
+		Pick *pick = &picks[i];
+		byte_buffer_append(&pick->client->out, pick->message.data, pick->message.size);
+		pick->client->held.insert(section_key(pick->pending.pos));
+		byte_buffer_free(&pick->message);
+
+		counter_add(&metrics.server_sections_sent, 1);
+		counter_add(&metrics.server_raw_bytes, chunk_raw_bytes(chunks[i]));
+		histogram_observe(&metrics.server_request_time, now - pick->pending.requested);
+	}
+}
+
+template <typename C>
+bool server_handle(WorldServer<C> *server, ServerClient *client, u32 type, u8 *payload, u32 size) {
+	if (!client->greeted && type != MSG_HELLO) {
+		return false;
+	}
+
+	switch (type) {
+		case MSG_HELLO: {
+			HelloMessage hello;
+			if (size != sizeof(hello)) {
+				return false;
+			}
+			memcpy(&hello, payload, sizeof(hello));
+
+			HelloMessage reply = hello_message();
+			message_append(&client->out, MSG_HELLO, &reply, sizeof(reply));
+			if (!hello_matches(&hello)) {
+				printf("Turning away a viewer built for %ux%ux%u chunks\n", hello.width, hello.height, hello.depth);
+				return false;
+			}
+			client->greeted = true;
+		} break;
+		case MSG_VIEWER: {
+			if (size != sizeof(ViewerMessage)) {
+				return false;
+			}
+			memcpy(&client->viewer, payload, sizeof(ViewerMessage));
+		} break;
+		case MSG_REQUEST: {
+			// Asking again for a section that's queued or held changes nothing
+			u64 now = metrics_now_ns();
+			u32 added = 0;
+			for (u32 i = 0; i + sizeof(SectionPos) <= size; i += sizeof(SectionPos)) {
+				PendingSection pending;
+				memcpy(&pending.pos, payload + i, sizeof(SectionPos));
+				u64 key = section_key(pending.pos);
+				if (client->held.count(key) != 0 || !client->queued.insert(key).second) {
+					continue;
+				}
+				pending.requested = now;
+				client->pending.push_back(pending);
+				added++;
+			}
+			gauge_add(&metrics.server_pending, added);
+			if (client->pending.size() > WORLD_SERVER_MAX_PENDING) {
+				printf("Dropping a viewer with over %u sections requested\n", WORLD_SERVER_MAX_PENDING);
+				return false;
+			}
+		} break;
+		case MSG_DROP: {
+			std::unordered_set<u64> dropped;
+			for (u32 i = 0; i + sizeof(SectionPos) <= size; i += sizeof(SectionPos)) {
+				SectionPos pos;
+				memcpy(&pos, payload + i, sizeof(pos));
+				dropped.insert(section_key(pos));
+				client->queued.erase(section_key(pos));
+				client->held.erase(section_key(pos));
+			}
+
+			u32 before = client->pending.size();
+			client->pending.erase(std::remove_if(client->pending.begin(), client->pending.end(), [&](const PendingSection &p) {
+				return dropped.count(section_key(p.pos)) != 0;
+			}), client->pending.end());
+			gauge_add(&metrics.server_pending, -(i64)(before - client->pending.size()));
+		} break;
+		case MSG_EDIT: {
+			for (u32 i = 0; i + sizeof(BlockEdit) <= size; i += sizeof(BlockEdit)) {
+				BlockEdit edit;
+				memcpy(&edit, payload + i, sizeof(edit));
+				server->edits.push_back(edit);
+			}
+		} break;
+		default: {
+			return false;
+		}
+	}
+	return true;
+}
+
+// One round of the server: accepts viewers, reads their messages, applies edits,
+// serves queued sections and sends what fits. Waits up to timeout_ms when there's
+// nothing queued to serve.
+// Frees what no viewer holds or has queued once more than max_sections are
+// loaded, see WORLD_SERVER_MAX_SECTIONS
+template <typename C>
+void server_evict_sections(WorldServer<C> *server) {
+	if (server->max_sections == 0 || server->sections.size() <= server->max_sections) {
+		return;
+	}
+
+	std::vector<std::pair<f32, u64>> unused;
+	for (auto it = server->sections.begin(); it != server->sections.end(); ++it) {
+		if (server->edited.count(it->first) != 0) {
+			continue;
+		}
+
+		C *chunk = it->second;
+		f32 cx = chunk->x_off + (C::width + 2) * 0.5f, cy = chunk->y_off + (C::height + 2) * 0.5f, cz = chunk->z_off + (C::depth + 2) * 0.5f;
+		f32 nearest = FLT_MAX;
+		bool wanted = false;
+		for (u32 i = 0; i < server->clients.size() && !wanted; i++) {
+			ServerClient *client = server->clients[i];
+			wanted = client->held.count(it->first) != 0 || client->queued.count(it->first) != 0;
+			ViewerMessage v = client->viewer;
+			nearest = std::min(nearest, (cx - v.x) * (cx - v.x) + (cy - v.y) * (cy - v.y) + (cz - v.z) * (cz - v.z));
+		}
+		if (!wanted) {
+			unused.push_back(std::make_pair(nearest, it->first));
+		}
+	}
+
+	u32 target = server->max_sections - server->max_sections / 8;
+	u32 n = std::min((u32)unused.size(), (u32)server->sections.size() - target);
+	std::partial_sort(unused.begin(), unused.begin() + n, unused.end(), [](const std::pair<f32, u64> &a, const std::pair<f32, u64> &b) {
+		return a.first > b.first;
+	});
+	for (u32 i = 0; i < n; i++) {
+		auto it = server->sections.find(unused[i].second);
+		free_chunk(it->second);
+		server->sections.erase(it);
+	}
+	counter_add(&metrics.server_sections_evicted, n);
+}
+
+template <typename C>
+void world_server_poll(WorldServer<C> *server, i32 timeout_ms) {
+	bool busy = false;
+	for (u32 i = 0; i < server->clients.size(); i++) {
+		ServerClient *client = server->clients[i];
+		if (!client->pending.empty() && byte_buffer_pending(&client->out) < WORLD_SERVER_WINDOW) {
+			busy = true;
+		}
+	}
+
+	std::vector<struct pollfd> fds(server->clients.size() + 1);
+	fds[0].fd = server->listen_fd;
+	fds[0].events = POLLIN;
+	for (u32 i = 0; i < server->clients.size(); i++) {
+		fds[i + 1].fd = server->clients[i]->fd;
+		fds[i + 1].events = POLLIN | (byte_buffer_pending(&server->clients[i]->out) > 0 ? POLLOUT : 0);
+	}
+	poll(fds.data(), fds.size(), busy ? 0 : timeout_ms);
+
+	if (fds[0].revents & POLLIN) {
+		for (;;) {
+			i32 fd = accept(server->listen_fd, NULL, NULL);
+			if (fd < 0) {
+				break;
+			}
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+			ServerClient *client = new ServerClient();
+			client->fd = fd;
+			client->greeted = false;
+			client->closed = false;
+			memset(&client->in, 0, sizeof(client->in));
+			memset(&client->out, 0, sizeof(client->out));
+			memset(&client->viewer, 0, sizeof(client->viewer));
+			server->clients.push_back(client);
+			gauge_add(&metrics.server_clients, 1);
+		}
+	}
+
+	for (u32 i = 0; i + 1 < fds.size(); i++) {
+		ServerClient *client = server->clients[i];
+		if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+			client->closed = !socket_read(client->fd, &client->in);
+			if (!messages_parse(&client->in, [&](u32 type, u8 *payload, u32 size) { return server_handle(server, client, type, payload, size); })) {
+				client->closed = true;
+			}
+		}
+	}
+
+	server_apply_edits(server);
+	server_serve(server);
+	server_evict_sections(server);
+
+	for (u32 i = 0; i < server->clients.size(); i++) {
+		ServerClient *client = server->clients[i];
+		u64 sent = 0;
+		if (!socket_write(client->fd, &client->out, &sent)) {
+			client->closed = true;
+		}
+		counter_add(&metrics.server_bytes_sent, sent);
+	}
+
+	for (u32 i = 0; i < server->clients.size();) {
+		if (server->clients[i]->closed) {
+			server_client_close(server->clients[i]);
+			server->clients.erase(server->clients.begin() + i);
+		} else {
+			i++;
+		}
+	}
+}
+
+typedef struct WorldClient {
+	i32 fd;
+	ByteBuffer in;
+	ByteBuffer out;
+
+	u64 bytes_received;
+	u64 bytes_sent;
+} WorldClient;
+
+// Sends as much of what's queued as the socket takes without blocking, so a server
+// that stops reading can't stall the frame. The rest goes out on a later call,
+// world_client_receive() flushes too. Returns false once the server is gone.
+bool world_client_flush(WorldClient *client) {
+	return socket_write(client->fd, &client->out, &client->bytes_sent);
+}
+
+void world_client_send(WorldClient *client, u32 type, const void *payload, u32 size) {
+	message_append(&client->out, type, payload, size);
+	world_client_flush(client);
+}
+
+void world_client_viewer(WorldClient *client, f32 x, f32 y, f32 z) {
+	ViewerMessage viewer;
+	viewer.x = x;
+	viewer.y = y;
+	viewer.z = z;
+	world_client_send(client, MSG_VIEWER, &viewer, sizeof(viewer));
+}
+
+void world_client_request(WorldClient *client, SectionPos *positions, u32 count) {
+	if (count > 0) {
+		world_client_send(client, MSG_REQUEST, positions, count * sizeof(SectionPos));
+	}
+}
+
+void world_client_drop(WorldClient *client, SectionPos *positions, u32 count) {
+	if (count > 0) {
+		world_client_send(client, MSG_DROP, positions, count * sizeof(SectionPos));
+	}
+}
+
+void world_client_edit(WorldClient *client, BlockEdit *edits, u32 count) {
+	if (count > 0) {
+		world_client_send(client, MSG_EDIT, edits, count * sizeof(BlockEdit));
+	}
+}
+
+// Sends what's still queued, then calls handle(type, payload, size) for every
+// complete message that has arrived, waiting up to timeout_ms for the first
+// bytes. Returns false once the server is gone.
+template <typename F>
+bool world_client_receive(WorldClient *client, i32 timeout_ms, F handle) {
+	struct pollfd pfd;
+	pfd.fd = client->fd;
+	for (;;) {
+		if (!world_client_flush(client)) {
+			return false;
+		}
+
+		// Room opening up for the rest of the queue wakes the wait too
+		pfd.events = POLLIN | (byte_buffer_pending(&client->out) > 0 ? POLLOUT : 0);
+		if (poll(&pfd, 1, timeout_ms) <= 0) {
+			return true;
+		}
+		if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+			break;
+		}
+	}
+
+	u32 before = client->in.size - client->in.start;
+	bool open = socket_read(client->fd, &client->in);
+	client->bytes_received += byte_buffer_pending(&client->in) - before;
+
+	return messages_parse(&client->in, [&](u32 type, u8 *payload, u32 size) { handle(type, payload, size); return true; }) && open;
+}
+
+void world_client_close(WorldClient *client) {
+	close(client->fd);
+	byte_buffer_free(&client->in);
+	byte_buffer_free(&client->out);
+}
+
+// Connects and trades hellos, taking the server's seed. Returns false when there's
+// no server or it serves chunks of another size.
+bool world_client_connect(WorldClient *client, const char *socket_path) {
+	memset(client, 0, sizeof(WorldClient));
+	client->fd = unix_socket(socket_path, false);
+	if (client->fd < 0) {
+		return false;
+	}
+	fcntl(client->fd, F_SETFL, fcntl(client->fd, F_GETFL) | O_NONBLOCK);
+
+	HelloMessage hello = hello_message();
+	world_client_send(client, MSG_HELLO, &hello, sizeof(hello));
+
+	bool greeted = false;
+	bool matches = false;
+	while (!greeted) {
+		bool open = world_client_receive(client, -1, [&](u32 type, u8 *payload, u32 size) {
+			if (type == MSG_HELLO && size == sizeof(HelloMessage)) {
+				memcpy(&hello, payload, sizeof(hello));
+				greeted = true;
+				matches = hello_matches(&hello);
+			}
+		});
+		if (!open && !greeted) {
+			break;
+		}
+	}
+
+	if (!matches) {
+		printf("World server %s doesn't serve %ux%ux%u chunks!\n", socket_path, CHUNK_WIDTH, CHUNK_HEIGHT, CHUNK_DEPTH);
+		world_client_close(client);
+		return false;
+	}
+
+	world_seed = hello.seed;
+	return true;
+}
+
+#endif
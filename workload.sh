@@ -0,0 +1,29 @@
+#!/bin/sh
+# Deterministic generation, meshing and rendering workload, used to train the
+# PGO build and to compare the release variants. Usage: ./workload.sh BUILD_DIR
+# Fails when the viewer was built but there's no display or xvfb-run to run it on.
+set -e
+BUILD=${1:-_build}
+WORLD=$(mktemp -d)
+
+"$BUILD/chunk_bench"
+"$BUILD/pregen" -threads 1 -rect 0 0 7 7 "$WORLD" | tail -n 1
+rm -rf "$WORLD"
+
+if [ -x "$BUILD/render_bench" ]; then
+	"$BUILD/render_bench" | grep '^render:'
+else
+	echo "render_bench not built (no EGL), skipping the headless render workload"
+fi
+
+FRAMES=${SNOW_BENCH_FRAMES:-1000}
+if [ ! -x "$BUILD/snow" ]; then
+	echo "snow viewer not built, skipping the viewer workload"
+elif [ -n "$DISPLAY$WAYLAND_DISPLAY" ]; then
+	SNOW_BENCH_FRAMES=$FRAMES "$BUILD/snow" | grep '^bench:'
+elif command -v xvfb-run > /dev/null; then
+	SNOW_BENCH_FRAMES=$FRAMES xvfb-run -a "$BUILD/snow" | grep '^bench:'
+else
+	echo "workload.sh: the snow viewer is built but there's no display or xvfb-run, it was NOT run" >&2
+	exit 2
+fi